@@ -408,7 +408,14 @@ class base_memory_buffer : public channel_buffer {
 
   void append(const char* str) { return append(str, std::strlen(str)); }
 
-  void push_back(const std::uint8_t val) { return append(&val, sizeof(val)); }
+  void push_back(const std::uint8_t val) {
+    if (write_ < capacity_) {
+      static_cast<std::uint8_t*>(data_)[write_++] = val;
+      return;
+    }
+
+    return append(&val, sizeof(val));
+  }
 
   using channel_buffer::begin;
   using channel_buffer::begin_read;
@@ -468,4 +475,99 @@ using buffer_2k = base_memory_buffer<2048>;
 using buffer_4k = base_memory_buffer<4096>;
 using buffer_8k = base_memory_buffer<8192>;
 
+// std::format_to 的输出迭代器，直接写入可写区域，写满时就地扩容。
+// 写入的字符在格式化结束后对返回的迭代器调用 commit 才计入缓冲区
+template <std::size_t Fixed>
+class buffer_appender {
+ public:
+  using iterator_category = std::output_iterator_tag;
+  using value_type = void;
+  using difference_type = std::ptrdiff_t;
+  using pointer = void;
+  using reference = void;
+
+  explicit buffer_appender(base_memory_buffer<Fixed>& buf) noexcept
+      : buf_(&buf),
+        next_(reinterpret_cast<char*>(buf.begin())),
+        last_(next_ + buf.writable()) {}
+
+  auto operator=(const char ch) -> buffer_appender& {
+    if (next_ == last_) grow();
+    *next_++ = ch;
+    return *this;
+  }
+
+  constexpr auto operator*() noexcept -> buffer_appender& { return *this; }
+
+  constexpr auto operator++() noexcept -> buffer_appender& { return *this; }
+
+  constexpr auto operator++(int) noexcept -> buffer_appender { return *this; }
+
+  void commit() noexcept {
+    buf_->written(static_cast<std::size_t>(
+        next_ - reinterpret_cast<char*>(buf_->begin())));
+  }
+
+ private:
+  void grow() {
+    commit();
+    buf_->make_sure_writable((std::max)(buf_->capacity(), std::size_t{256}));
+    next_ = reinterpret_cast<char*>(buf_->begin());
+    last_ = next_ + buf_->writable();
+  }
+
+  base_memory_buffer<Fixed>* buf_;
+  char* next_;
+  char* last_;
+};
+
+template <typename T>
+concept chars_number =
+    std::is_arithmetic_v<T> && !std::same_as<T, bool> &&
+    !std::same_as<T, char> && !std::same_as<T, long double>;
+
+// 用 std::to_chars 直接写入可写区域
+template <std::size_t Fixed, chars_number T>
+void append_number(base_memory_buffer<Fixed>& buf, const T value) {
+  // 整数最多20位加符号，浮点数最短表示最多24个字符
+  constexpr std::size_t max_chars = 32;
+  buf.make_sure_writable(max_chars);
+  auto* first = reinterpret_cast<char*>(buf.begin());
+  const auto result = std::to_chars(first, first + buf.writable(), value);
+  buf.written(static_cast<std::size_t>(result.ptr - first));
+}
+
+template <std::size_t Fixed>
+void vformat_to(base_memory_buffer<Fixed>& buf, const std::string_view fmt,
+                const std::format_args args) {
+  std::vformat_to(buffer_appender<Fixed>{buf}, fmt, args).commit();
+}
+
+/**
+ * 代替 std::format_to(std::back_inserter(buf), ...)
+ *
+ * 直接格式化到可写区域，空间不足时就地扩容，参数只格式化一次；
+ * 格式字符串为 "{}" 的单个数字或字符串参数不经过 std::format。
+ */
+template <std::size_t Fixed, typename... Args>
+void format_to(base_memory_buffer<Fixed>& buf,
+               const std::format_string<Args...> fmt, Args&&... args) {
+  if constexpr (sizeof...(Args) == 1) {
+    using type = std::remove_cvref_t<Args...>;
+    if constexpr (chars_number<type>) {
+      if (fmt.get() == "{}") {
+        return append_number(buf, args...);
+      }
+    } else if constexpr (std::is_convertible_v<const type&,
+                                               std::string_view>) {
+      if (fmt.get() == "{}") {
+        return buf.append(std::string_view(args...));
+      }
+    }
+  }
+
+  std::format_to(buffer_appender<Fixed>{buf}, fmt, std::forward<Args>(args)...)
+      .commit();
+}
+
 }  // namespace jt::detail
@@ -16,3 +16,7 @@
 #else
 #define JT_API
 #endif
+
+#ifndef JT_LOG_ACTIVE_LEVEL
+#define JT_LOG_ACTIVE_LEVEL 6
+#endif
@@ -0,0 +1,98 @@
+export module jt:detail.eventcount;
+
+import std;
+import :detail.cache_line;
+import :detail.cpu_pause;
+
+export namespace jt::detail {
+
+/**
+ * 事件计数器，用于单个消费者等待多个生产者
+ *
+ * 消费者先 prepare_wait 取得当前序号，再检查条件，条件不满足时 wait_for，
+ * 满足时 cancel_wait。生产者改变条件后 notify，消费者没有在等待时
+ * 只有一次内存屏障和一次读取，不加锁也不进入内核。
+ *
+ * 休眠前先自旋，自旋次数在 [min_spin, max_spin] 之间自适应：
+ * 自旋期间等到了事件就加倍，否则减半。消费者只在真正休眠前设置 parked_，
+ * 自旋期间生产者只修改序号，不进行系统调用。
+ *
+ * Linux 使用 futex，Windows 使用 WaitOnAddress；其他平台没有带超时的
+ * 地址等待，休眠时每毫秒轮询一次序号，空闲时也会定期醒来。
+ */
+class eventcount {
+ public:
+  eventcount() = default;
+
+  eventcount(const eventcount&) = delete;
+  eventcount(eventcount&&) = delete;
+  auto operator=(const eventcount&) -> eventcount& = delete;
+  auto operator=(eventcount&&) -> eventcount& = delete;
+
+  // max_spin 为 0 时不自旋，直接休眠
+  void set_spin(const std::uint32_t min_spin,
+                const std::uint32_t max_spin) noexcept {
+    min_spin_ = (std::min)(min_spin, max_spin);
+    max_spin_ = max_spin;
+    spin_ = max_spin;
+  }
+
+  [[nodiscard]] auto prepare_wait() noexcept -> std::uint32_t {
+    waiters_.fetch_add(1, std::memory_order::seq_cst);
+    return epoch_.load(std::memory_order::seq_cst);
+  }
+
+  void cancel_wait() noexcept {
+    waiters_.fetch_sub(1, std::memory_order::relaxed);
+  }
+
+  // 等到 notify 或超时，返回 false 表示超时
+  auto wait_for(const std::uint32_t key,
+                const std::chrono::milliseconds timeout) noexcept -> bool {
+    for (std::uint32_t i = 0; i < spin_; ++i) {
+      if (epoch_.load(std::memory_order::acquire) != key) {
+        spin_ = (std::min)(spin_ * 2, max_spin_);
+        waiters_.fetch_sub(1, std::memory_order::relaxed);
+        return true;
+      }
+      cpu_pause();
+    }
+    spin_ = (std::max)(spin_ / 2, min_spin_);
+
+    parked_.store(true, std::memory_order::seq_cst);
+    const bool notified = park(key, timeout);
+    parked_.store(false, std::memory_order::relaxed);
+    waiters_.fetch_sub(1, std::memory_order::relaxed);
+    return notified;
+  }
+
+  void notify() noexcept {
+    // 与 prepare_wait 配对：要么这里看到等待者，要么消费者看到新的条件
+    std::atomic_thread_fence(std::memory_order::seq_cst);
+    if (waiters_.load(std::memory_order::relaxed) == 0) return;
+
+    // 与 wait_for 配对：要么这里看到 parked_，要么 park 看到新的序号
+    epoch_.fetch_add(1, std::memory_order::seq_cst);
+    if (!parked_.load(std::memory_order::seq_cst)) return;
+
+    return wake();
+  }
+
+ private:
+  // 序号不等于 key 时返回 true，超时返回 false
+  auto park(std::uint32_t key, std::chrono::milliseconds timeout) noexcept
+      -> bool;
+
+  void wake() noexcept;
+
+  alignas(cache_line_bytes) std::atomic<std::uint32_t> epoch_{0};
+  std::atomic<std::uint32_t> waiters_{0};
+  // 消费者已经停止自旋，即将或正在休眠
+  std::atomic<bool> parked_{false};
+  // 只由消费者修改
+  alignas(cache_line_bytes) std::uint32_t spin_{0};
+  std::uint32_t min_spin_{0};
+  std::uint32_t max_spin_{0};
+};
+
+}  // namespace jt::detail
@@ -0,0 +1,175 @@
+module;
+
+#include "config.h"
+
+export module jt:detail.file;
+
+import std;
+import :detail.buffer;
+import :detail.vector;
+
+export namespace jt::detail {
+
+// 以追加方式打开的文件，直接使用系统调用写入，不经过 iostream
+class JT_API append_file {
+ public:
+  append_file() = default;
+
+  ~append_file() noexcept;
+
+  append_file(const append_file&) = delete;
+  append_file(append_file&&) = delete;
+  auto operator=(const append_file&) -> append_file& = delete;
+  auto operator=(append_file&&) -> append_file& = delete;
+
+  // append 为 false 时不使用 O_APPEND，由调用方按偏移写入
+  auto open(const std::filesystem::path& path, std::error_code& ec,
+            bool append = true) -> bool;
+
+  void close() noexcept;
+
+  [[nodiscard]] auto is_open() const noexcept -> bool { return fd_ >= 0; }
+
+  [[nodiscard]] auto native_handle() const noexcept -> int { return fd_; }
+
+  // 当前文件大小
+  [[nodiscard]] auto size(std::error_code& ec) const -> std::size_t;
+
+  // 按顺序写入全部缓冲区，尽量合并为一次系统调用
+  auto write(std::span<const read_buffer> buffers, std::error_code& ec)
+      -> bool;
+
+  // 移动文件位置，不使用 O_APPEND 的文件改回顺序写入时使用
+  auto seek(std::uint64_t offset) noexcept -> bool;
+
+  // 等待已写入的数据落盘，Linux 上为 fdatasync
+  auto sync(std::error_code& ec) noexcept -> bool;
+
+ private:
+  int fd_{-1};
+};
+
+// 写完全部数据，只使用异步信号安全的系统调用，供崩溃处理使用
+JT_API auto write_fd(int fd, const void* data, std::size_t size) noexcept
+    -> bool;
+
+// 基于 io_uring 的异步写入，最多 depth 个缓冲区同时在途，完成后回收复用。
+// 按偏移写入，文件不能以 O_APPEND 打开。
+// 非 Linux 平台或内核不支持时 init 返回 false；
+// 内核不支持 IORING_OP_WRITE 时自动退回同步的 pwrite
+class JT_API uring_writer {
+ public:
+  uring_writer() = default;
+
+  ~uring_writer() noexcept;
+
+  uring_writer(const uring_writer&) = delete;
+  uring_writer(uring_writer&&) = delete;
+  auto operator=(const uring_writer&) -> uring_writer& = delete;
+  auto operator=(uring_writer&&) -> uring_writer& = delete;
+
+  auto init(unsigned depth) -> bool;
+
+  [[nodiscard]] auto valid() const noexcept -> bool { return ring_fd_ >= 0; }
+
+  // 把 buf 的内容交换到空闲的缓冲区后提交，buf 换回一个空的缓冲区；
+  // 所有缓冲区都在途时等待最早的写入完成
+  void write(int fd, std::uint64_t offset, buffer_1k& buf);
+
+  // 在之前提交的写入都完成后执行 fdatasync
+  void fsync(int fd);
+
+  // 等待所有在途的请求完成，返回最后一次失败的错误
+  auto wait_all() -> std::error_code;
+
+ private:
+  struct slot {
+    buffer_1k buf;
+    int fd{-1};
+    std::uint64_t offset{0};
+    std::size_t written{0};
+    bool busy{false};
+  };
+
+  auto submit_write(std::size_t index) -> bool;
+  void write_sync(slot& s);
+  void reap(bool wait);
+  void unmap() noexcept;
+
+  int ring_fd_{-1};
+  bool sync_fallback_{false};
+  void* sq_ptr_{nullptr};
+  std::size_t sq_size_{0};
+  void* cq_ptr_{nullptr};
+  std::size_t cq_size_{0};
+  void* sqes_ptr_{nullptr};
+  std::size_t sqes_size_{0};
+  unsigned* sq_head_{nullptr};
+  unsigned* sq_tail_{nullptr};
+  unsigned* sq_mask_{nullptr};
+  unsigned* sq_array_{nullptr};
+  unsigned* cq_head_{nullptr};
+  unsigned* cq_tail_{nullptr};
+  unsigned* cq_mask_{nullptr};
+  void* cqes_{nullptr};
+  std::size_t in_flight_{0};
+  std::error_code error_{};
+  vector<slot> slots_{};
+};
+
+// 预分配并映射到内存的文件段，写入只是 memcpy
+// 关闭时截断为实际写入的长度。已写入的长度同时记在映射的旁路文件
+// （文件名加 .size）中，异常退出后重新打开时据此找到写入位置，
+// 正常关闭时删除。只支持 POSIX，其他平台 open 返回 not_supported
+class JT_API mapped_file {
+ public:
+  mapped_file() = default;
+
+  ~mapped_file() noexcept;
+
+  mapped_file(const mapped_file&) = delete;
+  mapped_file(mapped_file&&) = delete;
+  auto operator=(const mapped_file&) -> mapped_file& = delete;
+  auto operator=(mapped_file&&) -> mapped_file& = delete;
+
+  // 文件已存在时从已写入的数据之后继续写，段大小至少为 capacity
+  auto open(const std::filesystem::path& path, std::size_t capacity,
+            std::error_code& ec) -> bool;
+
+  void close() noexcept;
+
+  [[nodiscard]] auto is_open() const noexcept -> bool {
+    return data_ != nullptr;
+  }
+
+  // 已写入的字节数
+  [[nodiscard]] auto size() const noexcept -> std::size_t { return size_; }
+
+  [[nodiscard]] auto capacity() const noexcept -> std::size_t {
+    return capacity_;
+  }
+
+  // 剩余空间不足时不写入并返回 false
+  auto write(const void* data, std::size_t size) noexcept -> bool;
+
+  // async 为 true 时只发起回写，不等待完成
+  auto sync(bool async, std::error_code& ec) noexcept -> bool;
+
+ private:
+  auto open_committed(std::error_code& ec) -> bool;
+  // 打开失败时保留上次异常退出留下的旁路文件
+  void close_committed(bool remove) noexcept;
+
+  int fd_{-1};
+  std::uint8_t* data_{nullptr};
+  std::size_t size_{0};
+  std::size_t capacity_{0};
+  // 旁路文件
+  std::filesystem::path committed_path_{};
+  int committed_fd_{-1};
+  std::uint64_t* committed_{nullptr};
+  // 打开前旁路文件已经存在，说明上次没有正常关闭
+  bool recovered_{false};
+};
+
+}  // namespace jt::detail
@@ -0,0 +1,62 @@
+module;
+
+#if defined(_WIN32)
+#include <Windows.h>
+#elif defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+// module jt:detail.eventcount;
+module jt;
+
+import std;
+import :detail.eventcount;
+
+namespace jt::detail {
+
+auto eventcount::park(const std::uint32_t key,
+                      const std::chrono::milliseconds timeout) noexcept
+    -> bool {
+  const auto deadline = std::chrono::steady_clock::now() + timeout;
+  while (epoch_.load(std::memory_order::seq_cst) == key) {
+    const auto now = std::chrono::steady_clock::now();
+    if (now >= deadline) return false;
+
+    const auto left =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - now);
+#if defined(_WIN32)
+    auto expected = key;
+    ::WaitOnAddress(
+        &epoch_, &expected, sizeof(expected),
+        static_cast<DWORD>(
+            std::chrono::ceil<std::chrono::milliseconds>(left).count()));
+#elif defined(__linux__)
+    timespec ts{};
+    ts.tv_sec = static_cast<time_t>(left.count() / 1000000000);
+    ts.tv_nsec = static_cast<long>(left.count() % 1000000000);
+    // 返回值不用检查，醒来后重新比较序号
+    ::syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&epoch_),
+              FUTEX_WAIT_PRIVATE, key, &ts, nullptr, 0);
+#else
+    // 没有带超时的地址等待，退化为每毫秒轮询，wake 什么也不做
+    constexpr std::chrono::nanoseconds poll = std::chrono::milliseconds(1);
+    std::this_thread::sleep_for((std::min)(left, poll));
+#endif
+  }
+  return true;
+}
+
+void eventcount::wake() noexcept {
+#if defined(_WIN32)
+  ::WakeByAddressAll(&epoch_);
+#elif defined(__linux__)
+  ::syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&epoch_),
+            FUTEX_WAKE_PRIVATE, std::numeric_limits<int>::max(), nullptr,
+            nullptr, 0);
+#endif
+}
+
+}  // namespace jt::detail
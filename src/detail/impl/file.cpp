@@ -0,0 +1,700 @@
+module;
+
+#if defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#define JT_HAS_IO_URING 1
+#endif
+#endif
+
+#include <cerrno>
+
+// module jt:detail.file;
+module jt;
+
+import std;
+import :detail.file;
+
+namespace jt::detail {
+
+append_file::~append_file() noexcept { close(); }
+
+auto append_file::open(const std::filesystem::path& path, std::error_code& ec,
+                       const bool append) -> bool {
+  close();
+  ec.clear();
+#if defined(_WIN32)
+  fd_ = ::_wopen(path.c_str(),
+                 _O_WRONLY | _O_CREAT | _O_BINARY | (append ? _O_APPEND : 0),
+                 _S_IREAD | _S_IWRITE);
+#else
+  do {
+    fd_ = ::open(path.c_str(),
+                 O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : 0),
+                 0644);
+  } while (fd_ < 0 && errno == EINTR);
+#endif
+  if (fd_ < 0) {
+    ec.assign(errno, std::generic_category());
+    return false;
+  }
+
+  return true;
+}
+
+void append_file::close() noexcept {
+  if (fd_ < 0) return;
+
+#if defined(_WIN32)
+  ::_close(fd_);
+#else
+  ::close(fd_);
+#endif
+  fd_ = -1;
+}
+
+auto append_file::size(std::error_code& ec) const -> std::size_t {
+  ec.clear();
+#if defined(_WIN32)
+  struct _stat64 st {};
+  if (::_fstat64(fd_, &st) != 0) {
+#else
+  struct stat st {};
+  if (::fstat(fd_, &st) != 0) {
+#endif
+    ec.assign(errno, std::generic_category());
+    return 0;
+  }
+
+  return static_cast<std::size_t>(st.st_size);
+}
+
+auto append_file::write(std::span<const read_buffer> buffers,
+                        std::error_code& ec) -> bool {
+  ec.clear();
+#if defined(_WIN32)
+  for (const auto& buf : buffers) {
+    auto* ptr = static_cast<const char*>(buf.data());
+    std::size_t left = buf.capacity();
+    while (left > 0) {
+      const auto chunk = static_cast<unsigned int>(
+          (std::min)(left, std::size_t{std::numeric_limits<int>::max()}));
+      const int n = ::_write(fd_, ptr, chunk);
+      if (n < 0) {
+        ec.assign(errno, std::generic_category());
+        return false;
+      }
+      ptr += n;
+      left -= static_cast<std::size_t>(n);
+    }
+  }
+  return true;
+#else
+  constexpr std::size_t max_iov = 64;
+  iovec iov[max_iov];
+  while (!buffers.empty()) {
+    std::size_t count = 0;
+    for (; count < buffers.size() && count < max_iov; ++count) {
+      iov[count].iov_base = const_cast<void*>(buffers[count].data());
+      iov[count].iov_len = buffers[count].capacity();
+    }
+    buffers = buffers.subspan(count);
+
+    iovec* current = iov;
+    while (count > 0) {
+      const auto n = ::writev(fd_, current, static_cast<int>(count));
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        ec.assign(errno, std::generic_category());
+        return false;
+      }
+
+      // 处理部分写入
+      auto left = static_cast<std::size_t>(n);
+      while (count > 0 && left >= current->iov_len) {
+        left -= current->iov_len;
+        ++current;
+        --count;
+      }
+      if (count > 0) {
+        current->iov_base = static_cast<char*>(current->iov_base) + left;
+        current->iov_len -= left;
+      }
+    }
+  }
+  return true;
+#endif
+}
+
+auto append_file::seek(const std::uint64_t offset) noexcept -> bool {
+#if defined(_WIN32)
+  return ::_lseeki64(fd_, static_cast<__int64>(offset), SEEK_SET) >= 0;
+#else
+  return ::lseek(fd_, static_cast<off_t>(offset), SEEK_SET) >= 0;
+#endif
+}
+
+auto append_file::sync(std::error_code& ec) noexcept -> bool {
+#if defined(_WIN32)
+  const int result = ::_commit(fd_);
+#elif defined(__APPLE__)
+  const int result = ::fsync(fd_);
+#else
+  int result;
+  do {
+    result = ::fdatasync(fd_);
+  } while (result != 0 && errno == EINTR);
+#endif
+  if (result != 0) {
+    ec.assign(errno, std::generic_category());
+    return false;
+  }
+  return true;
+}
+
+auto write_fd(const int fd, const void* data, std::size_t size) noexcept
+    -> bool {
+  auto* ptr = static_cast<const char*>(data);
+  while (size > 0) {
+#if defined(_WIN32)
+    const auto n = ::_write(
+        fd, ptr,
+        static_cast<unsigned int>((std::min)(
+            size, std::size_t{std::numeric_limits<int>::max()})));
+#else
+    const auto n = ::write(fd, ptr, size);
+#endif
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    ptr += n;
+    size -= static_cast<std::size_t>(n);
+  }
+  return true;
+}
+
+uring_writer::~uring_writer() noexcept {
+  if (!valid()) return;
+
+  wait_all();
+  unmap();
+}
+
+#if defined(JT_HAS_IO_URING)
+
+namespace {
+
+constexpr std::uint64_t fsync_user_data = ~std::uint64_t{0};
+
+auto io_uring_setup(const unsigned entries, io_uring_params* params) -> int {
+  return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+auto io_uring_enter(const int fd, const unsigned to_submit,
+                    const unsigned min_complete, const unsigned flags) -> int {
+  return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit,
+                                    min_complete, flags, nullptr, 0));
+}
+
+auto load_acquire(unsigned* ptr) -> unsigned {
+  return std::atomic_ref(*ptr).load(std::memory_order::acquire);
+}
+
+void store_release(unsigned* ptr, const unsigned value) {
+  std::atomic_ref(*ptr).store(value, std::memory_order::release);
+}
+
+}  // namespace
+
+auto uring_writer::init(const unsigned depth) -> bool {
+  if (valid()) return true;
+
+  io_uring_params params{};
+  const int fd = io_uring_setup(depth, &params);
+  if (fd < 0) return false;
+
+  ring_fd_ = fd;
+  sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  const bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_mmap) {
+    sq_size_ = cq_size_ = (std::max)(sq_size_, cq_size_);
+  }
+
+  sq_ptr_ = ::mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (sq_ptr_ == MAP_FAILED) {
+    sq_ptr_ = nullptr;
+    unmap();
+    return false;
+  }
+
+  if (single_mmap) {
+    cq_ptr_ = sq_ptr_;
+  } else {
+    cq_ptr_ = ::mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (cq_ptr_ == MAP_FAILED) {
+      cq_ptr_ = nullptr;
+      unmap();
+      return false;
+    }
+  }
+
+  sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+  sqes_ptr_ = ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (sqes_ptr_ == MAP_FAILED) {
+    sqes_ptr_ = nullptr;
+    unmap();
+    return false;
+  }
+
+  auto* sq = static_cast<std::uint8_t*>(sq_ptr_);
+  sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+  sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+  sq_mask_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+  sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+  auto* cq = static_cast<std::uint8_t*>(cq_ptr_);
+  cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+  cq_mask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+  cqes_ = cq + params.cq_off.cqes;
+
+  // 留一个提交项给 fsync
+  slots_.resize((std::max)(params.sq_entries, 2u) - 1);
+  return true;
+}
+
+void uring_writer::unmap() noexcept {
+  if (sqes_ptr_ != nullptr) ::munmap(sqes_ptr_, sqes_size_);
+  if (cq_ptr_ != nullptr && cq_ptr_ != sq_ptr_) ::munmap(cq_ptr_, cq_size_);
+  if (sq_ptr_ != nullptr) ::munmap(sq_ptr_, sq_size_);
+  sqes_ptr_ = cq_ptr_ = sq_ptr_ = nullptr;
+  if (ring_fd_ >= 0) {
+    ::close(ring_fd_);
+    ring_fd_ = -1;
+  }
+}
+
+void uring_writer::write(const int fd, const std::uint64_t offset,
+                         buffer_1k& buf) {
+  if (buf.readable() == 0) return;
+
+  auto it = std::ranges::find(slots_, false, &slot::busy);
+  while (it == slots_.end()) {
+    reap(true);
+    it = std::ranges::find(slots_, false, &slot::busy);
+  }
+
+  std::swap(it->buf, buf);
+  buf.clear();
+  it->fd = fd;
+  it->offset = offset;
+  it->written = 0;
+  it->busy = true;
+  const auto index = static_cast<std::size_t>(it - slots_.begin());
+  if (sync_fallback_ || !submit_write(index)) {
+    write_sync(*it);
+  }
+
+  // 顺便回收已完成的缓冲区
+  reap(false);
+}
+
+void uring_writer::fsync(const int fd) {
+  if (sync_fallback_) {
+    error_ = wait_all();
+    if (::fdatasync(fd) != 0) {
+      error_.assign(errno, std::generic_category());
+    }
+    return;
+  }
+
+  const auto tail = *sq_tail_;
+  const auto index = tail & *sq_mask_;
+  auto* sqe = static_cast<io_uring_sqe*>(sqes_ptr_) + index;
+  std::memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_FSYNC;
+  sqe->flags = IOSQE_IO_DRAIN;
+  sqe->fd = fd;
+  sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+  sqe->user_data = fsync_user_data;
+  sq_array_[index] = index;
+  store_release(sq_tail_, tail + 1);
+  while (io_uring_enter(ring_fd_, 1, 0, 0) < 0) {
+    if (errno == EINTR) continue;
+
+    // 同步落盘之前先等在途的写入完成，否则可能先于它们返回
+    store_release(sq_tail_, tail);
+    error_ = wait_all();
+    if (::fdatasync(fd) != 0) {
+      error_.assign(errno, std::generic_category());
+    }
+    return;
+  }
+  ++in_flight_;
+}
+
+auto uring_writer::wait_all() -> std::error_code {
+  while (in_flight_ > 0) {
+    reap(true);
+  }
+  return std::exchange(error_, {});
+}
+
+auto uring_writer::submit_write(const std::size_t index) -> bool {
+  auto& s = slots_[index];
+  const auto tail = *sq_tail_;
+  const auto sq_index = tail & *sq_mask_;
+  auto* sqe = static_cast<io_uring_sqe*>(sqes_ptr_) + sq_index;
+  std::memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_WRITE;
+  sqe->fd = s.fd;
+  sqe->off = s.offset + s.written;
+  sqe->addr = reinterpret_cast<std::uint64_t>(s.buf.begin_read() + s.written);
+  sqe->len = static_cast<std::uint32_t>(
+      (std::min)(s.buf.readable() - s.written,
+                 std::size_t{std::numeric_limits<std::int32_t>::max()}));
+  sqe->user_data = index;
+  sq_array_[sq_index] = sq_index;
+  store_release(sq_tail_, tail + 1);
+  while (true) {
+    if (io_uring_enter(ring_fd_, 1, 0, 0) >= 0) break;
+    if (errno == EINTR) continue;
+
+    store_release(sq_tail_, tail);
+    return false;
+  }
+
+  ++in_flight_;
+  return true;
+}
+
+void uring_writer::reap(const bool wait) {
+  if (wait && in_flight_ > 0) {
+    while (io_uring_enter(ring_fd_, 0, 1, IORING_ENTER_GETEVENTS) < 0 &&
+           errno == EINTR) {
+    }
+  }
+
+  auto head = *cq_head_;
+  const auto tail = load_acquire(cq_tail_);
+  for (; head != tail; ++head) {
+    const auto& cqe = static_cast<io_uring_cqe*>(cqes_)[head & *cq_mask_];
+    --in_flight_;
+    if (cqe.user_data == fsync_user_data) {
+      if (cqe.res < 0) {
+        error_.assign(-cqe.res, std::generic_category());
+      }
+      continue;
+    }
+
+    auto& s = slots_[cqe.user_data];
+    if (cqe.res == -EINVAL || cqe.res == -EOPNOTSUPP) {
+      // 内核不支持 IORING_OP_WRITE
+      sync_fallback_ = true;
+      write_sync(s);
+      continue;
+    }
+
+    if (cqe.res < 0) {
+      error_.assign(-cqe.res, std::generic_category());
+      s.buf.clear();
+      s.busy = false;
+      continue;
+    }
+
+    // 部分写入时提交剩余部分
+    s.written += static_cast<std::size_t>(cqe.res);
+    if (s.written < s.buf.readable() && cqe.res > 0 &&
+        submit_write(cqe.user_data)) {
+      continue;
+    }
+    if (s.written < s.buf.readable()) {
+      write_sync(s);
+      continue;
+    }
+
+    s.buf.clear();
+    s.busy = false;
+  }
+  store_release(cq_head_, head);
+}
+
+#else
+
+auto uring_writer::init(unsigned) -> bool { return false; }
+
+void uring_writer::unmap() noexcept {}
+
+void uring_writer::write(int, std::uint64_t, buffer_1k&) {}
+
+void uring_writer::fsync(int) {}
+
+auto uring_writer::wait_all() -> std::error_code { return {}; }
+
+auto uring_writer::submit_write(std::size_t) -> bool { return false; }
+
+void uring_writer::reap(bool) {}
+
+#endif
+
+#if defined(_WIN32)
+
+void uring_writer::write_sync(slot&) {}
+
+#else
+
+void uring_writer::write_sync(slot& s) {
+  while (s.written < s.buf.readable()) {
+    const auto n = ::pwrite(s.fd, s.buf.begin_read() + s.written,
+                            s.buf.readable() - s.written,
+                            static_cast<off_t>(s.offset + s.written));
+    if (n < 0) {
+      if (errno == EINTR) continue;
+
+      error_.assign(errno, std::generic_category());
+      break;
+    }
+    s.written += static_cast<std::size_t>(n);
+  }
+  s.buf.clear();
+  s.busy = false;
+}
+
+#endif
+
+mapped_file::~mapped_file() noexcept { close(); }
+
+#if defined(_WIN32)
+
+auto mapped_file::open(const std::filesystem::path&, std::size_t,
+                       std::error_code& ec) -> bool {
+  ec = std::make_error_code(std::errc::not_supported);
+  return false;
+}
+
+void mapped_file::close() noexcept {}
+
+auto mapped_file::write(const void*, std::size_t) noexcept -> bool {
+  return false;
+}
+
+auto mapped_file::sync(bool, std::error_code& ec) noexcept -> bool {
+  ec = std::make_error_code(std::errc::not_supported);
+  return false;
+}
+
+#else
+
+namespace {
+
+// 为 [offset, capacity) 分配磁盘块，写入映射时不会因为磁盘满而 SIGBUS。
+// 返回 0 或 errno
+auto reserve_space(const int fd, const std::size_t offset,
+                   const std::size_t capacity) -> int {
+#if defined(__APPLE__)
+  fstore_t store{F_ALLOCATEALL, F_PEOFPOSMODE, 0,
+                 static_cast<off_t>(capacity - offset), 0};
+  if (::fcntl(fd, F_PREALLOCATE, &store) != -1) {
+    return ::ftruncate(fd, static_cast<off_t>(capacity)) == 0 ? 0 : errno;
+  }
+#else
+  const int result = ::posix_fallocate(fd, static_cast<off_t>(offset),
+                                       static_cast<off_t>(capacity - offset));
+  if (result == 0) return 0;
+  if (result != EINVAL && result != EOPNOTSUPP) return result;
+#endif
+
+  // 文件系统不支持预分配，写入 0 来分配
+  static constexpr std::array<char, 64 * 1024> zeros{};
+  std::size_t pos = offset;
+  while (pos < capacity) {
+    const auto n = ::pwrite(fd, zeros.data(),
+                            (std::min)(zeros.size(), capacity - pos),
+                            static_cast<off_t>(pos));
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return errno;
+    }
+    pos += static_cast<std::size_t>(n);
+  }
+  return 0;
+}
+
+}  // namespace
+
+auto mapped_file::open_committed(std::error_code& ec) -> bool {
+  // 确定旁路文件是新建的之前，失败时都保留它
+  recovered_ = true;
+  do {
+    committed_fd_ = ::open(committed_path_.c_str(),
+                           O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  } while (committed_fd_ < 0 && errno == EINTR);
+  if (committed_fd_ < 0) {
+    ec.assign(errno, std::generic_category());
+    return false;
+  }
+
+  struct stat st {};
+  if (::fstat(committed_fd_, &st) != 0) {
+    ec.assign(errno, std::generic_category());
+    close_committed(!recovered_);
+    return false;
+  }
+
+  recovered_ = static_cast<std::size_t>(st.st_size) >= sizeof(std::uint64_t);
+  if (!recovered_) {
+    if (const int result =
+            reserve_space(committed_fd_, 0, sizeof(std::uint64_t));
+        result != 0) {
+      ec.assign(result, std::generic_category());
+      close_committed(!recovered_);
+      return false;
+    }
+  }
+
+  void* data = ::mmap(nullptr, sizeof(std::uint64_t), PROT_READ | PROT_WRITE,
+                      MAP_SHARED, committed_fd_, 0);
+  if (data == MAP_FAILED) {
+    ec.assign(errno, std::generic_category());
+    close_committed(!recovered_);
+    return false;
+  }
+  committed_ = static_cast<std::uint64_t*>(data);
+  return true;
+}
+
+void mapped_file::close_committed(const bool remove) noexcept {
+  if (committed_ != nullptr) {
+    ::munmap(committed_, sizeof(std::uint64_t));
+    committed_ = nullptr;
+  }
+  if (committed_fd_ >= 0) {
+    ::close(committed_fd_);
+    committed_fd_ = -1;
+    if (remove) ::unlink(committed_path_.c_str());
+  }
+}
+
+auto mapped_file::open(const std::filesystem::path& path,
+                       std::size_t capacity, std::error_code& ec) -> bool {
+  close();
+  ec.clear();
+  committed_path_ = path;
+  committed_path_ += ".size";
+  if (!open_committed(ec)) return false;
+
+  do {
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  } while (fd_ < 0 && errno == EINTR);
+  if (fd_ < 0) {
+    ec.assign(errno, std::generic_category());
+    close_committed(!recovered_);
+    return false;
+  }
+
+  struct stat st {};
+  if (::fstat(fd_, &st) != 0) {
+    ec.assign(errno, std::generic_category());
+    ::close(fd_);
+    fd_ = -1;
+    close_committed(!recovered_);
+    return false;
+  }
+
+  const auto existing = static_cast<std::size_t>(st.st_size);
+  capacity = (std::max)(capacity, existing);
+  if (existing < capacity) {
+    if (const int result = reserve_space(fd_, existing, capacity);
+        result != 0) {
+      ec.assign(result, std::generic_category());
+      ::ftruncate(fd_, static_cast<off_t>(existing));
+      ::close(fd_);
+      fd_ = -1;
+      close_committed(!recovered_);
+      return false;
+    }
+  }
+
+  void* data = ::mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      fd_, 0);
+  if (data == MAP_FAILED) {
+    ec.assign(errno, std::generic_category());
+    // 恢复原来的长度
+    ::ftruncate(fd_, static_cast<off_t>(existing));
+    ::close(fd_);
+    fd_ = -1;
+    close_committed(!recovered_);
+    return false;
+  }
+
+  data_ = static_cast<std::uint8_t*>(data);
+  capacity_ = capacity;
+  // 异常退出时文件没有截断，末尾是预分配的空间，以旁路文件记录的长度为准
+  size_ = existing;
+  if (recovered_) {
+    size_ = static_cast<std::size_t>(
+        (std::min)(std::atomic_ref{*committed_}.load(
+                       std::memory_order::relaxed),
+                   std::uint64_t{existing}));
+  }
+  std::atomic_ref{*committed_}.store(size_, std::memory_order::relaxed);
+  return true;
+}
+
+void mapped_file::close() noexcept {
+  if (fd_ < 0) return;
+
+  if (data_ != nullptr) {
+    ::munmap(data_, capacity_);
+    data_ = nullptr;
+  }
+  ::ftruncate(fd_, static_cast<off_t>(size_));
+  ::close(fd_);
+  fd_ = -1;
+  size_ = 0;
+  capacity_ = 0;
+  // 截断之后才删除旁路文件
+  close_committed(true);
+}
+
+auto mapped_file::write(const void* data, const std::size_t size) noexcept
+    -> bool {
+  if (data_ == nullptr || capacity_ - size_ < size) return false;
+
+  std::memcpy(data_ + size_, data, size);
+  size_ += size;
+  std::atomic_ref{*committed_}.store(size_, std::memory_order::release);
+  return true;
+}
+
+auto mapped_file::sync(const bool async, std::error_code& ec) noexcept
+    -> bool {
+  ec.clear();
+  if (data_ == nullptr || size_ == 0) return true;
+
+  const int flags = async ? MS_ASYNC : MS_SYNC;
+  if (::msync(data_, size_, flags) != 0 ||
+      ::msync(committed_, sizeof(std::uint64_t), flags) != 0) {
+    ec.assign(errno, std::generic_category());
+    return false;
+  }
+  return true;
+}
+
+#endif
+
+}  // namespace jt::detail
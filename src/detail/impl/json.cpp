@@ -0,0 +1,181 @@
+module;
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#define JT_JSON_SSE2
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define JT_JSON_NEON
+#endif
+
+// module jt:detail.json;
+module jt;
+
+import std;
+import :detail.json;
+
+namespace jt::detail {
+
+namespace {
+
+// 非 ASCII 字节也要停下来校验 UTF-8
+constexpr bool needs_escape(const unsigned char ch) noexcept {
+  return ch == '"' || ch == '\\' || ch < 0x20 || ch >= 0x80;
+}
+
+// 返回 [pos, size) 中第一个需要转义或校验的位置，没有则返回 size
+std::size_t find_escape(const char* data, std::size_t pos,
+                        const std::size_t size) noexcept {
+#if defined(__AVX2__)
+  {
+    const auto quote = _mm256_set1_epi8('"');
+    const auto backslash = _mm256_set1_epi8('\\');
+    const auto control = _mm256_set1_epi8(0x1F);
+    for (; pos + 32 <= size; pos += 32) {
+      const auto v =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + pos));
+      // v <= 0x1F 等价于 min(v, 0x1F) == v
+      const auto m = _mm256_or_si256(
+          _mm256_or_si256(_mm256_cmpeq_epi8(v, quote),
+                          _mm256_cmpeq_epi8(v, backslash)),
+          _mm256_cmpeq_epi8(_mm256_min_epu8(v, control), v));
+      // 最高位为 1 的是非 ASCII 字节
+      if (const auto mask = static_cast<std::uint32_t>(
+              _mm256_movemask_epi8(_mm256_or_si256(m, v)));
+          mask != 0) {
+        return pos + static_cast<std::size_t>(std::countr_zero(mask));
+      }
+    }
+  }
+#endif
+#if defined(JT_JSON_SSE2)
+  {
+    const auto quote = _mm_set1_epi8('"');
+    const auto backslash = _mm_set1_epi8('\\');
+    const auto control = _mm_set1_epi8(0x1F);
+    for (; pos + 16 <= size; pos += 16) {
+      const auto v =
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+      const auto m =
+          _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote),
+                                    _mm_cmpeq_epi8(v, backslash)),
+                       _mm_cmpeq_epi8(_mm_min_epu8(v, control), v));
+      if (const auto mask =
+              static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_or_si128(m, v)));
+          mask != 0) {
+        return pos + static_cast<std::size_t>(std::countr_zero(mask));
+      }
+    }
+  }
+#elif defined(JT_JSON_NEON)
+  {
+    const auto quote = vdupq_n_u8('"');
+    const auto backslash = vdupq_n_u8('\\');
+    const auto control = vdupq_n_u8(0x1F);
+    for (; pos + 16 <= size; pos += 16) {
+      const auto v =
+          vld1q_u8(reinterpret_cast<const std::uint8_t*>(data + pos));
+      const auto m = vorrq_u8(
+          vorrq_u8(vceqq_u8(v, quote), vceqq_u8(v, backslash)),
+          vorrq_u8(vcleq_u8(v, control), vcgeq_u8(v, vdupq_n_u8(0x80))));
+      // 每个字节压缩为4位
+      const auto mask = vget_lane_u64(
+          vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+      if (mask != 0) {
+        return pos + static_cast<std::size_t>(std::countr_zero(mask) / 4);
+      }
+    }
+  }
+#endif
+
+  for (; pos < size; ++pos) {
+    if (needs_escape(static_cast<unsigned char>(data[pos]))) return pos;
+  }
+  return size;
+}
+
+// 从 data 开始的合法 UTF-8 序列的长度，不合法时返回 0。
+// 排除过长编码、代理项和大于 U+10FFFF 的码点
+std::size_t utf8_length(const unsigned char* data,
+                        const std::size_t left) noexcept {
+  const auto lead = data[0];
+  std::size_t length;
+  unsigned char low = 0x80;
+  unsigned char high = 0xBF;
+  if (lead >= 0xC2 && lead <= 0xDF) {
+    length = 2;
+  } else if (lead >= 0xE0 && lead <= 0xEF) {
+    length = 3;
+    if (lead == 0xE0) low = 0xA0;
+    if (lead == 0xED) high = 0x9F;
+  } else if (lead >= 0xF0 && lead <= 0xF4) {
+    length = 4;
+    if (lead == 0xF0) low = 0x90;
+    if (lead == 0xF4) high = 0x8F;
+  } else {
+    return 0;
+  }
+
+  if (left < length || data[1] < low || data[1] > high) return 0;
+  for (std::size_t i = 2; i < length; ++i) {
+    if ((data[i] & 0xC0) != 0x80) return 0;
+  }
+  return length;
+}
+
+void append_escaped_char(buffer_1k& buf, const unsigned char ch) {
+  switch (ch) {
+    case '"':
+      return buf.append("\\\"", 2);
+    case '\\':
+      return buf.append("\\\\", 2);
+    case '\n':
+      return buf.append("\\n", 2);
+    case '\r':
+      return buf.append("\\r", 2);
+    case '\t':
+      return buf.append("\\t", 2);
+    case '\b':
+      return buf.append("\\b", 2);
+    case '\f':
+      return buf.append("\\f", 2);
+    default: {
+      constexpr char hex[] = "0123456789abcdef";
+      const char escaped[] = {'\\', 'u', '0', '0', hex[ch >> 4], hex[ch & 0xF]};
+      return buf.append(escaped, sizeof(escaped));
+    }
+  }
+}
+
+}  // namespace
+
+void append_json_escaped(buffer_1k& buf, const std::string_view text) {
+  const char* data = text.data();
+  const auto size = text.size();
+  for (std::size_t start = 0; start < size;) {
+    const auto pos = find_escape(data, start, size);
+    buf.append(data + start, pos - start);
+    if (pos == size) break;
+
+    const auto ch = static_cast<unsigned char>(data[pos]);
+    if (ch < 0x80) {
+      append_escaped_char(buf, ch);
+      start = pos + 1;
+      continue;
+    }
+
+    const auto length = utf8_length(
+        reinterpret_cast<const unsigned char*>(data + pos), size - pos);
+    if (length == 0) {
+      // 不合法的字节逐个替换
+      buf.append("\\ufffd", 6);
+      start = pos + 1;
+    } else {
+      buf.append(data + pos, length);
+      start = pos + length;
+    }
+  }
+}
+
+}  // namespace jt::detail
@@ -0,0 +1,141 @@
+module;
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || \
+    defined(_M_IX86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// module jt:detail.tsc_clock;
+module jt;
+
+import std;
+import :detail.tsc_clock;
+
+namespace jt::detail {
+
+auto tsc_clock::supported() noexcept -> bool {
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || \
+    defined(_M_IX86)
+  // CPUID.80000007H:EDX[8] 为 invariant TSC
+#if defined(_MSC_VER)
+  int regs[4];
+  __cpuid(regs, static_cast<int>(0x80000000));
+  if (static_cast<unsigned>(regs[0]) < 0x80000007) return false;
+  __cpuid(regs, static_cast<int>(0x80000007));
+  return (static_cast<unsigned>(regs[3]) & (1u << 8)) != 0;
+#else
+  unsigned a, b, c, d;
+  if (__get_cpuid(0x80000007, &a, &b, &c, &d) == 0) return false;
+  return (d & (1u << 8)) != 0;
+#endif
+#elif defined(__aarch64__) && !defined(_MSC_VER)
+  // 通用定时器的频率是固定的
+  return true;
+#else
+  return false;
+#endif
+}
+
+auto tsc_clock::enable() -> bool {
+  if (!supported()) return false;
+
+  std::scoped_lock lock{mutex_};
+  if (enabled_.load(std::memory_order::relaxed)) return true;
+
+  const auto first = sample();
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  const auto second = sample();
+  if (second.tick <= first.tick || second.ns <= first.ns) return false;
+
+  ns_per_tick_ = static_cast<double>(second.ns - first.ns) /
+                 static_cast<double>(second.tick - first.tick);
+  publish(second, ns_per_tick_);
+  enabled_.store(true, std::memory_order::release);
+  return true;
+}
+
+void tsc_clock::recalibrate() {
+  if (!enabled() || read() < next_tick_.load(std::memory_order::relaxed)) {
+    return;
+  }
+
+  const std::unique_lock lock{mutex_, std::try_to_lock};
+  if (!lock.owns_lock()) return;
+
+  // 其他线程刚刚校准过
+  const auto next = sample();
+  if (next.tick < next_tick_.load(std::memory_order::relaxed)) return;
+
+  if (next.tick > last_.tick && next.ns > last_.ns) {
+    const auto measured = static_cast<double>(next.ns - last_.ns) /
+                          static_cast<double>(next.tick - last_.tick);
+    // system_clock 被调整时算出的频率明显偏离，这时只更新基准点
+    if (std::abs(measured - ns_per_tick_) < ns_per_tick_ / 100) {
+      ns_per_tick_ = measured;
+    }
+  }
+  publish(next, ns_per_tick_);
+}
+
+auto tsc_clock::to_time_point(const std::uint64_t tick) const noexcept
+    -> time_point {
+  std::uint32_t version;
+  std::uint64_t base_tick;
+  std::int64_t base_ns;
+  double ns_per_tick;
+  do {
+    version = version_.load(std::memory_order::acquire);
+    const auto& c = calibrations_[version % 2];
+    base_tick = c.tick.load(std::memory_order::relaxed);
+    base_ns = c.ns.load(std::memory_order::relaxed);
+    ns_per_tick = c.ns_per_tick.load(std::memory_order::relaxed);
+    std::atomic_thread_fence(std::memory_order::acquire);
+  } while (version_.load(std::memory_order::relaxed) != version);
+
+  // 校准之前采集的计数器小于基准点，差值为负
+  const auto delta = static_cast<std::int64_t>(tick - base_tick);
+  const std::chrono::nanoseconds ns{
+      base_ns + std::llround(static_cast<double>(delta) * ns_per_tick)};
+  return time_point{
+      std::chrono::duration_cast<std::chrono::system_clock::duration>(ns)};
+}
+
+auto tsc_clock::sample() noexcept -> anchor {
+  // 取读取窗口最小的一次，计数器取窗口的中点
+  anchor result;
+  auto window = std::numeric_limits<std::uint64_t>::max();
+  for (int i = 0; i < 8; ++i) {
+    const auto begin = read();
+    const auto now = std::chrono::system_clock::now();
+    const auto end = read();
+    if (end - begin >= window) continue;
+
+    window = end - begin;
+    result.tick = begin + window / 2;
+    result.ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    now.time_since_epoch())
+                    .count();
+  }
+  return result;
+}
+
+void tsc_clock::publish(const anchor& at, const double ns_per_tick) noexcept {
+  const auto version = version_.load(std::memory_order::relaxed) + 1;
+  // 读者读到下面写入的数据时，一定也能看到上一次版本号的变化
+  std::atomic_thread_fence(std::memory_order::release);
+  auto& c = calibrations_[version % 2];
+  c.tick.store(at.tick, std::memory_order::relaxed);
+  c.ns.store(at.ns, std::memory_order::relaxed);
+  c.ns_per_tick.store(ns_per_tick, std::memory_order::relaxed);
+  version_.store(version, std::memory_order::release);
+
+  last_ = at;
+  next_tick_.store(at.tick + static_cast<std::uint64_t>(1e9 / ns_per_tick),
+                   std::memory_order::relaxed);
+}
+
+}  // namespace jt::detail
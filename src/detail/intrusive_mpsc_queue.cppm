@@ -64,6 +64,26 @@ class intrusive_mpsc_queue<Next> {
     front_ = next;
     return front;
   }
+
+  // 不出队，依次访问队列中的节点。与 pop_front 并发时结果不确定，
+  // 只用于崩溃时尽力读出剩余的数据
+  template <class F>
+  void visit_unsafe(F&& f) const noexcept {
+    const void* node = front_;
+    bool passed_nil = false;
+    while (node != nullptr) {
+      if (node == static_cast<const void*>(&nil_)) {
+        // 再次经过 nil_ 说明读到了出队之前的旧值
+        if (passed_nil) break;
+        passed_nil = true;
+        node = nil_.load(std::memory_order_acquire);
+        continue;
+      }
+      auto* current = static_cast<Node*>(const_cast<void*>(node));
+      f(*current);
+      node = (current->*Next).load(std::memory_order_acquire);
+    }
+  }
 };
 
 }  // namespace jt::detail
\ No newline at end of file
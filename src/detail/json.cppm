@@ -0,0 +1,21 @@
+module;
+
+#include "config.h"
+
+export module jt:detail.json;
+
+import std;
+import :detail.buffer;
+
+export namespace jt::detail {
+
+/**
+ * 把 text 按 JSON 字符串的规则转义后追加到 buf，不含两侧的引号
+ *
+ * 每次检查16/32字节中是否有引号、反斜杠、控制字符和非 ASCII 字节，
+ * 都没有时整段拷贝。非 ASCII 字节逐个序列校验 UTF-8，合法的原样输出，
+ * 不合法的字节替换为 \ufffd，输出总是合法的 JSON。
+ */
+JT_API void append_json_escaped(buffer_1k& buf, std::string_view text);
+
+}  // namespace jt::detail
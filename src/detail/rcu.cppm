@@ -0,0 +1,127 @@
+export module jt:detail.rcu;
+
+import std;
+import :detail.cache_line;
+import :detail.memory;
+
+export namespace jt::detail {
+
+/**
+ * 读者不加锁的宽限期
+ *
+ * 每个分片有两个计数，读者进入时在自己分片上当前纪元的计数加一。
+ * 写者替换指针后调用 synchronize：翻转纪元，只等待旧纪元的计数归零，
+ * 之后进入的读者计入新纪元，不会让写者一直等待。
+ * 线程第一次进入时按顺序分到一个分片，分片数以内的线程不共用缓存行。
+ */
+class rcu_domain {
+ public:
+  class reader {
+   public:
+    explicit reader(std::atomic<std::uint32_t>& count) noexcept
+        : count_(count) {}
+
+    ~reader() noexcept { count_.fetch_sub(1, std::memory_order::release); }
+
+    reader(const reader&) = delete;
+    reader(reader&&) = delete;
+    auto operator=(const reader&) -> reader& = delete;
+    auto operator=(reader&&) -> reader& = delete;
+
+   private:
+    std::atomic<std::uint32_t>& count_;
+  };
+
+  rcu_domain() = default;
+
+  rcu_domain(const rcu_domain&) = delete;
+  rcu_domain(rcu_domain&&) = delete;
+  auto operator=(const rcu_domain&) -> rcu_domain& = delete;
+  auto operator=(rcu_domain&&) -> rcu_domain& = delete;
+
+  // 持有返回值期间读到的指针不会被释放
+  [[nodiscard]] auto enter() const noexcept -> reader {
+    auto& slot = readers_[reader_index() % readers_.size()];
+    const auto epoch = epoch_.load(std::memory_order::seq_cst) & 1;
+    slot.count[epoch].fetch_add(1, std::memory_order::seq_cst);
+    return reader{slot.count[epoch]};
+  }
+
+  // 等待调用之前进入的读者全部离开
+  void synchronize() {
+    std::scoped_lock lock{mutex_};
+    const auto epoch = epoch_.load(std::memory_order::relaxed) & 1;
+    // 上次翻转前读到纪元、翻转后才计数的读者留在另一组，
+    // 它们可能持有这次要释放的版本，先等它们离开
+    wait_zero(epoch ^ 1);
+    epoch_.store(epoch ^ 1, std::memory_order::seq_cst);
+    wait_zero(epoch);
+  }
+
+ private:
+  struct alignas(cache_line_bytes) reader_slot {
+    std::array<std::atomic<std::uint32_t>, 2> count{};
+  };
+
+  static auto reader_index() noexcept -> std::uint32_t {
+    static std::atomic<std::uint32_t> next{0};
+    thread_local const auto index =
+        next.fetch_add(1, std::memory_order::relaxed);
+    return index;
+  }
+
+  void wait_zero(const std::uint32_t epoch) const {
+    for (const auto& slot : readers_) {
+      while (slot.count[epoch].load(std::memory_order::seq_cst) != 0) {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  mutable std::array<reader_slot, 64> readers_{};
+  std::atomic<std::uint32_t> epoch_{0};
+  std::mutex mutex_{};
+};
+
+/**
+ * 读多写少的数据，读者不加锁，写者复制一份修改后整体替换
+ *
+ * 写者替换指针后经过 rcu_domain 的宽限期再释放旧版本。
+ * 写者之间由调用方串行化。
+ */
+template <typename T>
+class rcu_cell {
+ public:
+  rcu_cell() : current_(make_unique<T>().release()) {}
+
+  ~rcu_cell() noexcept { const unique_ptr<T> value{current_.load()}; }
+
+  rcu_cell(const rcu_cell&) = delete;
+  rcu_cell(rcu_cell&&) = delete;
+  auto operator=(const rcu_cell&) -> rcu_cell& = delete;
+  auto operator=(rcu_cell&&) -> rcu_cell& = delete;
+
+  // f 返回之后不能再引用 T 中的数据
+  template <typename F>
+  auto read(F&& f) const -> decltype(auto) {
+    const auto reader = domain_.enter();
+    return std::forward<F>(f)(
+        std::as_const(*current_.load(std::memory_order::seq_cst)));
+  }
+
+  // 在副本上调用 f，替换后等待旧版本的读者离开再释放
+  template <typename F>
+  void update(F&& f) {
+    auto next = make_unique<T>(*current_.load(std::memory_order::relaxed));
+    std::forward<F>(f)(*next);
+    const unique_ptr<T> old{
+        current_.exchange(next.release(), std::memory_order::seq_cst)};
+    domain_.synchronize();
+  }
+
+ private:
+  std::atomic<T*> current_;
+  rcu_domain domain_{};
+};
+
+}  // namespace jt::detail
@@ -0,0 +1,223 @@
+module;
+
+#include <cassert>
+
+export module jt:detail.spsc_ring;
+
+import std;
+import :detail.cache_line;
+import :detail.memory;
+
+export namespace jt::detail {
+
+/**
+ * 单生产者单消费者的变长记录环形缓冲区
+ *
+ * 每条记录前有8字节的头部（低32位为长度，高32位为标记），整体按8字节对齐；
+ * 尾部连续空间不足时写入一条填充记录，然后从缓冲区开头继续写。
+ * read_、write_ 是单调递增的字节序号。
+ *
+ * 消费者用 CAS 推进 read_，所以生产者也可以通过 drop_front 丢弃最旧的记录。
+ * 这种情况下消费者读到的数据可能已被覆盖，必须先用 read_bytes 拷贝出来，
+ * 再以 pop 的返回值确认数据是否有效（类似 seqlock）；生产者相应地用
+ * write_bytes 写入记录，双方对同一块内存都是原子访问。
+ */
+class spsc_ring {
+  static constexpr std::uint32_t flag_padding = 1;
+  static constexpr std::size_t header_size = sizeof(std::uint64_t);
+
+ public:
+  explicit spsc_ring(std::size_t capacity) {
+    capacity = std::bit_ceil((std::max)(capacity, std::size_t{4096}));
+    data_ = static_cast<std::uint8_t*>(allocate(capacity));
+    capacity_ = capacity;
+    mask_ = capacity - 1;
+  }
+
+  ~spsc_ring() noexcept { deallocate(data_, capacity_); }
+
+  spsc_ring(const spsc_ring&) = delete;
+  spsc_ring(spsc_ring&&) = delete;
+  auto operator=(const spsc_ring&) -> spsc_ring& = delete;
+  auto operator=(spsc_ring&&) -> spsc_ring& = delete;
+
+  [[nodiscard]] auto capacity() const noexcept -> std::size_t {
+    return capacity_;
+  }
+
+  // 生产者：写入 prepare 返回的空间
+  static void write_bytes(void* dest, const void* src,
+                          std::size_t size) noexcept {
+    auto* out = static_cast<std::uint8_t*>(dest);
+    const auto* in = static_cast<const std::uint8_t*>(src);
+    for (; size > 0 && std::bit_cast<std::uintptr_t>(out) % 8 != 0; --size) {
+      std::atomic_ref(*out++).store(*in++, std::memory_order::relaxed);
+    }
+    for (; size >= 8; size -= 8, in += 8, out += 8) {
+      std::uint64_t word;
+      std::memcpy(&word, in, sizeof(word));
+      std::atomic_ref(*reinterpret_cast<std::uint64_t*>(out))
+          .store(word, std::memory_order::relaxed);
+    }
+    for (; size > 0; --size) {
+      std::atomic_ref(*out++).store(*in++, std::memory_order::relaxed);
+    }
+  }
+
+  // 消费者：拷贝 front 返回的数据，之后由 pop 确认是否有效
+  static void read_bytes(void* dest, const void* src,
+                         std::size_t size) noexcept {
+    auto* out = static_cast<std::uint8_t*>(dest);
+    auto* in = static_cast<std::uint8_t*>(const_cast<void*>(src));
+    for (; size > 0 && std::bit_cast<std::uintptr_t>(in) % 8 != 0; --size) {
+      *out++ = std::atomic_ref(*in++).load(std::memory_order::relaxed);
+    }
+    for (; size >= 8; size -= 8, in += 8, out += 8) {
+      const auto word = std::atomic_ref(*reinterpret_cast<std::uint64_t*>(in))
+                            .load(std::memory_order::relaxed);
+      std::memcpy(out, &word, sizeof(word));
+    }
+    for (; size > 0; --size) {
+      *out++ = std::atomic_ref(*in++).load(std::memory_order::relaxed);
+    }
+  }
+
+  // 单条记录允许的最大长度，保证缓冲区为空时一定能写入
+  [[nodiscard]] auto max_record_size() const noexcept -> std::size_t {
+    return capacity_ / 2 - header_size;
+  }
+
+  [[nodiscard]] auto empty() const noexcept -> bool {
+    return read_.load(std::memory_order::seq_cst) ==
+           write_.load(std::memory_order::seq_cst);
+  }
+
+  // 生产者：申请 size 字节的写入空间，空间不足时返回 nullptr
+  [[nodiscard]] auto prepare(const std::size_t size) noexcept -> void* {
+    assert(size <= max_record_size());
+    const auto total = record_size(size);
+    auto pos = write_.load(std::memory_order::relaxed);
+    const auto offset = pos & mask_;
+    const auto contiguous = capacity_ - offset;
+    const auto need = contiguous < total ? total + contiguous : total;
+    if (capacity_ - (pos - cached_read_) < need) {
+      cached_read_ = read_.load(std::memory_order::acquire);
+      if (capacity_ - (pos - cached_read_) < need) {
+        return nullptr;
+      }
+    }
+
+    if (contiguous < total) {
+      store_header(offset, contiguous - header_size, flag_padding);
+      pos += contiguous;
+    }
+
+    store_header(pos & mask_, size, 0);
+    pending_ = pos + total;
+    return data_ + (pos & mask_) + header_size;
+  }
+
+  // 生产者：发布 prepare 申请的记录
+  // 返回 true 表示消费者此前已读完所有记录，可能正在休眠，需要唤醒
+  auto commit() noexcept -> bool {
+    const auto pos = write_.load(std::memory_order::relaxed);
+    write_.store(pending_, std::memory_order::seq_cst);
+    return read_.load(std::memory_order::seq_cst) >= pos;
+  }
+
+  // 生产者：丢弃最旧的一条记录，返回是否丢弃了有效记录
+  // 返回 false 时缓冲区为空或者消费者刚释放了空间，可以重新 prepare
+  auto drop_front() noexcept -> bool {
+    const auto limit = write_.load(std::memory_order::relaxed);
+    auto pos = read_.load(std::memory_order::acquire);
+    while (pos != limit) {
+      std::uint32_t flags;
+      const auto next = pos + record_size(load_header(pos & mask_, flags));
+      if (!read_.compare_exchange_strong(pos, next,
+                                         std::memory_order::seq_cst)) {
+        return false;
+      }
+
+      cached_read_ = next;
+      if (flags != flag_padding) {
+        return true;
+      }
+      pos = next;
+    }
+
+    return false;
+  }
+
+  // 消费者：取得最旧的一条记录，没有记录时返回空
+  [[nodiscard]] auto front() noexcept -> std::span<const std::uint8_t> {
+    auto pos = read_.load(std::memory_order::seq_cst);
+    while (pos != write_.load(std::memory_order::seq_cst)) {
+      const auto offset = pos & mask_;
+      std::uint32_t flags;
+      // 头部可能已被生产者覆盖，长度要限制在缓冲区内
+      const auto size = (std::min)(load_header(offset, flags),
+                                   capacity_ - offset - header_size);
+      if (flags == flag_padding) {
+        if (read_.compare_exchange_strong(pos, pos + record_size(size),
+                                          std::memory_order::seq_cst)) {
+          pos += record_size(size);
+        }
+        continue;
+      }
+
+      front_ = pos;
+      front_next_ = pos + record_size(size);
+      return {data_ + offset + header_size, size};
+    }
+
+    return {};
+  }
+
+  // 消费者：移除 front 返回的记录
+  // 返回 false 表示该记录已被生产者丢弃，之前读取的数据无效
+  auto pop() noexcept -> bool {
+    auto expected = front_;
+    return read_.compare_exchange_strong(expected, front_next_,
+                                         std::memory_order::seq_cst);
+  }
+
+ private:
+  [[nodiscard]] static constexpr auto record_size(
+      const std::size_t size) noexcept -> std::size_t {
+    return (header_size + size + header_size - 1) & ~(header_size - 1);
+  }
+
+  void store_header(const std::size_t offset, const std::size_t size,
+                    const std::uint32_t flags) noexcept {
+    const auto value = static_cast<std::uint64_t>(size) |
+                       (static_cast<std::uint64_t>(flags) << 32);
+    std::atomic_ref(*reinterpret_cast<std::uint64_t*>(data_ + offset))
+        .store(value, std::memory_order::relaxed);
+  }
+
+  [[nodiscard]] auto load_header(const std::size_t offset,
+                                 std::uint32_t& flags) const noexcept
+      -> std::size_t {
+    const auto value =
+        std::atomic_ref(*reinterpret_cast<std::uint64_t*>(data_ + offset))
+            .load(std::memory_order::relaxed);
+    flags = static_cast<std::uint32_t>(value >> 32);
+    return static_cast<std::uint32_t>(value);
+  }
+
+  std::uint8_t* data_{nullptr};
+  std::size_t capacity_{0};
+  std::size_t mask_{0};
+
+  // 生产者
+  alignas(cache_line_bytes) std::atomic<std::uint64_t> write_{0};
+  std::uint64_t pending_{0};
+  std::uint64_t cached_read_{0};
+
+  // 消费者
+  alignas(cache_line_bytes) std::atomic<std::uint64_t> read_{0};
+  std::uint64_t front_{0};
+  std::uint64_t front_next_{0};
+};
+
+}  // namespace jt::detail
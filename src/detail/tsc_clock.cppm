@@ -0,0 +1,94 @@
+module;
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || \
+    defined(_M_IX86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
+export module jt:detail.tsc_clock;
+
+import std;
+
+export namespace jt::detail {
+
+/**
+ * 基于 CPU 时间戳计数器的时钟
+ *
+ * 生产者只调用 read 读取计数器，写线程用 to_time_point 换算为
+ * system_clock 的时间。enable 时用 system_clock 校准一次，之后写线程
+ * 调用 recalibrate，每秒用相邻两次采样重新计算计数器的频率。
+ * CPU 没有不变的计数器时 enable 返回 false，调用方改用 system_clock。
+ */
+class tsc_clock {
+ public:
+  using time_point = std::chrono::system_clock::time_point;
+
+  tsc_clock() = default;
+
+  tsc_clock(const tsc_clock&) = delete;
+  tsc_clock(tsc_clock&&) = delete;
+  auto operator=(const tsc_clock&) -> tsc_clock& = delete;
+  auto operator=(tsc_clock&&) -> tsc_clock& = delete;
+
+  // 计数器频率恒定，且各个核心之间同步
+  static auto supported() noexcept -> bool;
+
+  static auto read() noexcept -> std::uint64_t {
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || \
+    defined(_M_IX86)
+    return __rdtsc();
+#elif defined(__aarch64__) && !defined(_MSC_VER)
+    std::uint64_t value;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(value));
+    return value;
+#else
+    return 0;
+#endif
+  }
+
+  // 校准期间会休眠约 10 毫秒
+  auto enable() -> bool;
+
+  [[nodiscard]] auto enabled() const noexcept -> bool {
+    return enabled_.load(std::memory_order::acquire);
+  }
+
+  // 距离上次校准不到 1 秒，或者其他线程正在校准时直接返回
+  void recalibrate();
+
+  // 不加锁，可以在信号处理函数中调用
+  [[nodiscard]] auto to_time_point(std::uint64_t tick) const noexcept
+      -> time_point;
+
+ private:
+  struct anchor {
+    std::uint64_t tick{0};
+    std::int64_t ns{0};
+  };
+
+  struct calibration {
+    std::atomic<std::uint64_t> tick{0};
+    std::atomic<std::int64_t> ns{0};
+    std::atomic<double> ns_per_tick{0};
+  };
+
+  static auto sample() noexcept -> anchor;
+
+  void publish(const anchor& at, double ns_per_tick) noexcept;
+
+  // 两份校准数据轮流写入，读者读完后版本号不变才说明没有读到一半
+  std::array<calibration, 2> calibrations_{};
+  std::atomic<std::uint32_t> version_{0};
+
+  std::atomic<bool> enabled_{false};
+  std::atomic<std::uint64_t> next_tick_{0};
+  std::mutex mutex_{};
+  anchor last_{};
+  double ns_per_tick_{0};
+};
+
+}  // namespace jt::detail
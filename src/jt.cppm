@@ -9,10 +9,16 @@ export import :detail.vector;
 export import :detail.unordered_map;
 
 export import :log.formatter;
+export import :log.pattern_formatter;
+export import :log.json_formatter;
 export import :log.sink;
 export import :log.level;
+export import :log.site;
 export import :log.logger;
 export import :log.service;
 export import :log.sink.console;
 export import :log.sink.file;
+export import :log.sink.binary;
+export import :log.sink.mmap;
+export import :log.deferred;
 export import :log.functions;
@@ -19,46 +19,109 @@ class default_formatter final : public formatter {
  public:
   void format(const message& msg, detail::buffer_1k& buf,  // NOLINT
               std::size_t& color_start, std::size_t& color_stop) override {
+    return format_line(msg.point, msg.lv, msg.tid, msg.sid,
+                       msg.where->file_name, msg.where->line,
+                       static_cast<std::string_view>(msg.buf), buf,
+                       color_start, color_stop);
+  }
+
+  [[nodiscard]] auto is_concurrent() const noexcept -> bool override {
+    return true;
+  }
+
+  [[nodiscard]] auto share_key() const noexcept -> const void* override {
+    return &typeid(default_formatter);
+  }
+
+  [[nodiscard]] auto is_plain_text() const noexcept -> bool override {
+    return true;
+  }
+
+  // 不依赖 message 的版本，供离线解码使用
+  void format(const std::chrono::system_clock::time_point& point,  // NOLINT
+              const level lv, const std::uint64_t tid, const std::uint32_t sid,
+              std::string_view file_name, const std::uint_least32_t line,
+              const std::string_view text, detail::buffer_1k& buf,
+              std::size_t& color_start, std::size_t& color_stop) {
+    if (const auto pos = file_name.find_last_of("/\\");
+        pos != std::string_view::npos) {
+      file_name = file_name.substr(pos + 1);
+    }
+    return format_line(point, lv, tid, sid, file_name, line, text, buf,
+                       color_start, color_stop);
+  }
+
+ private:
+  // file_name 已经不含目录
+  void format_line(const std::chrono::system_clock::time_point& point,
+                   const level lv, const std::uint64_t tid,
+                   const std::uint32_t sid, const std::string_view file_name,
+                   const std::uint_least32_t line, const std::string_view text,
+                   detail::buffer_1k& buf, std::size_t& color_start,
+                   std::size_t& color_stop) {
     // 时间
     using namespace std::chrono;
-    if (const auto current_second = system_clock::to_time_t(msg.point);
-        current_second != last_second_) {
-      last_second_ = current_second;
-      date_and_time_.clear();
-      std::format_to(std::back_inserter(date_and_time_), "{:%Y-%m-%d %H:%M:%S}",
-                     std::chrono::floor<std::chrono::seconds>(msg.point));
+    auto& date = date_;
+    if (const auto current_second = system_clock::to_time_t(point);
+        current_second != date.last_second) {
+      date.last_second = current_second;
+      date.text.clear();
+      detail::format_to(date.text, "{:%Y-%m-%d %H:%M:%S}",
+                        std::chrono::floor<std::chrono::seconds>(point));
     }
 
-    const auto millis = time_fraction<milliseconds>(msg.point);
-    std::string_view time_view(date_and_time_);
-    std::format_to(std::back_inserter(buf), "[{}.{:03}] [", time_view,
-                   millis.count());
+    const auto millis = time_fraction<milliseconds>(point).count();
+    buf.push_back('[');
+    buf.append(date.text.begin_read(), date.text.readable());
+    const char fraction[] = {'.', static_cast<char>('0' + millis / 100),
+                             static_cast<char>('0' + millis / 10 % 10),
+                             static_cast<char>('0' + millis % 10),
+                             ']', ' ', '['};
+    buf.append(fraction, sizeof(fraction));
     // 日志等级
     color_start = buf.readable();
-    buf.append(to_string_view(msg.lv));
+    buf.append(to_string_view(lv));
     color_stop = buf.readable();
     // 线程id
-    std::format_to(std::back_inserter(buf), "] [{:5}] ", msg.tid);
+    buf.append("] [", 3);
+    append_padded(buf, tid);
+    buf.append("] ", 2);
     // 服务id
-    if (msg.sid > 0) {
-      std::format_to(std::back_inserter(buf), "[{:5}] ", msg.sid);
+    if (sid > 0) {
+      buf.push_back('[');
+      append_padded(buf, sid);
+      buf.append("] ", 2);
     }
     // 代码文件、行数
-    std::string_view file_name = msg.source.file_name();
-    if (const auto pos = file_name.find_last_of("/\\");
-        pos != std::string_view::npos) {
-      file_name = file_name.substr(pos + 1);
-    }
-    std::format_to(std::back_inserter(buf), "[{}:{}] ", file_name,
-                   msg.source.line());
+    buf.push_back('[');
+    buf.append(file_name);
+    buf.push_back(':');
+    detail::append_number(buf, line);
+    buf.append("] ", 2);
     // 内容
-    buf.append(msg.buf.begin_read(), msg.buf.readable());
+    buf.append(text);
     buf.append("\n", 1);
   }
 
- private:
-  detail::base_memory_buffer<128> date_and_time_{};
-  std::time_t last_second_{0};
+  // 等同于 "{:5}"，数字右对齐，不足5位时左侧补空格
+  static void append_padded(detail::buffer_1k& buf, const std::uint64_t value) {
+    char digits[24];
+    const auto result = std::to_chars(std::begin(digits), std::end(digits),
+                                      value);
+    const auto size = static_cast<std::size_t>(result.ptr - digits);
+    constexpr std::size_t width = 5;
+    if (size < width) {
+      buf.append("     ", width - size);
+    }
+    buf.append(digits, size);
+  }
+
+  // 每个线程一份，多个线程可以同时格式化
+  struct date_cache {
+    detail::base_memory_buffer<128> text{};
+    std::time_t last_second{0};
+  };
+  static inline thread_local date_cache date_{};
 };
 
 }  // namespace jt::log
\ No newline at end of file
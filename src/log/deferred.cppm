@@ -0,0 +1,188 @@
+export module jt:log.deferred;
+
+import std;
+import :detail.buffer;
+
+export namespace jt::log {
+
+/**
+ * 延迟格式化
+ *
+ * 调用线程只把参数的原始字节和格式字符串指针写进 buf，
+ * 由写线程调用 format_deferred 完成 std::vformat_to。
+ * @code
+ * +-----------------+--------+--------+-----+
+ * | deferred_header | arg 0  | arg 1  | ... |
+ * +-----------------+--------+--------+-----+
+ * @endcode
+ * 字符串参数写入 uint32 长度和内容，其余参数直接拷贝对象的字节。
+ * 空的 const char* 只写入长度 deferred_null_string，格式化时报错。
+ */
+
+inline constexpr std::uint32_t deferred_null_string = 0xffffffff;
+
+// 自定义的可平凡复制类型可以特化为 true_type 来支持延迟格式化
+template <typename T>
+struct is_deferrable : std::false_type {};
+
+template <typename T>
+struct is_deferred_string : std::false_type {};
+
+template <>
+struct is_deferred_string<const char*> : std::true_type {};
+
+template <>
+struct is_deferred_string<char*> : std::true_type {};
+
+template <>
+struct is_deferred_string<std::string_view> : std::true_type {};
+
+template <typename Allocator>
+struct is_deferred_string<
+    std::basic_string<char, std::char_traits<char>, Allocator>>
+    : std::true_type {};
+
+template <typename T>
+concept deferred_arg =
+    std::is_arithmetic_v<T> || std::is_null_pointer_v<T> ||
+    std::same_as<T, const void*> || std::same_as<T, void*> ||
+    is_deferred_string<T>::value || is_deferrable<T>::value;
+
+template <typename... Args>
+concept deferrable = (deferred_arg<std::decay_t<Args>> && ...);
+
+// 写线程解码参数后使用的类型
+template <typename T>
+using deferred_value_t =
+    std::conditional_t<is_deferred_string<std::decay_t<T>>::value,
+                       std::string_view,
+                       std::conditional_t<std::same_as<std::decay_t<T>, void*>,
+                                          const void*, std::decay_t<T>>>;
+
+using deferred_formatter = void (*)(std::string_view fmt,
+                                    const std::uint8_t* data,
+                                    detail::buffer_1k& out);
+
+// 参数类型编码，供离线解码使用（例如 sink_binary），无法离线解码的类型为 '?'
+template <typename T>
+consteval auto deferred_code() -> char {
+  if constexpr (std::same_as<T, bool>) {
+    return 'b';
+  } else if constexpr (std::same_as<T, char>) {
+    return 'c';
+  } else if constexpr (std::is_integral_v<T> && sizeof(T) <= 8) {
+    constexpr std::string_view codes =
+        std::is_signed_v<T> ? std::string_view{"ahil"} : "AHIL";
+    return codes[std::bit_width(sizeof(T)) - 1];
+  } else if constexpr (std::same_as<T, float>) {
+    return 'f';
+  } else if constexpr (std::same_as<T, double>) {
+    return 'd';
+  } else if constexpr (std::same_as<T, long double>) {
+    return 'e';
+  } else if constexpr (std::same_as<T, const void*>) {
+    return 'p';
+  } else if constexpr (std::is_null_pointer_v<T>) {
+    return 'n';
+  } else if constexpr (std::same_as<T, std::string_view>) {
+    return 's';
+  } else {
+    return '?';
+  }
+}
+
+template <typename... Args>
+inline constexpr char deferred_signature[] = {
+    deferred_code<deferred_value_t<Args>>()..., '\0'};
+
+struct deferred_header {
+  deferred_formatter format;
+  const char* fmt;
+  std::size_t fmt_size;
+  const char* signature;
+};
+
+template <typename T>
+void encode_deferred_arg(detail::buffer_1k& buf, const T& value) {
+  using type = std::decay_t<T>;
+  if constexpr (is_deferred_string<type>::value) {
+    if constexpr (std::is_pointer_v<type>) {
+      if (value == nullptr) {
+        buf.append(&deferred_null_string, sizeof(deferred_null_string));
+        return;
+      }
+    }
+    const std::string_view strv(value);
+    const auto size = static_cast<std::uint32_t>(strv.size());
+    buf.append(&size, sizeof(size));
+    buf.append(strv.data(), size);
+  } else {
+    static_assert(std::is_trivially_copyable_v<type>,
+                  "deferred argument must be trivially copyable");
+    const deferred_value_t<T> copy = value;
+    buf.append(&copy, sizeof(copy));
+  }
+}
+
+template <typename T>
+auto decode_deferred_arg(const std::uint8_t*& data) -> deferred_value_t<T> {
+  if constexpr (is_deferred_string<std::decay_t<T>>::value) {
+    std::uint32_t size;
+    std::memcpy(&size, data, sizeof(size));
+    data += sizeof(size);
+    // 与 std::format 一样以 format_error 报告，由 format_deferred 处理
+    if (size == deferred_null_string) {
+      throw std::format_error("string pointer is null");
+    }
+    const std::string_view strv(
+        reinterpret_cast<const char*>(data), size);
+    data += size;
+    return strv;
+  } else {
+    deferred_value_t<T> value;
+    std::memcpy(&value, data, sizeof(value));
+    data += sizeof(value);
+    return value;
+  }
+}
+
+template <typename... Args>
+void format_deferred_args(const std::string_view fmt,
+                          const std::uint8_t* data, detail::buffer_1k& out) {
+  // 花括号初始化保证参数按顺序解码
+  std::tuple<deferred_value_t<Args>...> values{
+      decode_deferred_arg<Args>(data)...};
+  std::apply(
+      [&](auto&... args) {
+        detail::vformat_to(out, fmt, std::make_format_args(args...));
+      },
+      values);
+}
+
+template <typename... Args>
+  requires deferrable<Args...>
+void encode_deferred(detail::buffer_1k& buf, const std::string_view fmt,
+                     const Args&... args) {
+  const deferred_header header{&format_deferred_args<Args...>, fmt.data(),
+                               fmt.size(), deferred_signature<Args...>};
+  buf.append(&header, sizeof(header));
+  (encode_deferred_arg(buf, args), ...);
+}
+
+// 写线程：把 args 中的参数格式化到 out
+inline void format_deferred(const detail::buffer_1k& args,
+                            detail::buffer_1k& out) {
+  deferred_header header;
+  if (args.readable() < sizeof(header)) return;
+
+  std::memcpy(&header, args.begin_read(), sizeof(header));
+  const std::string_view fmt(header.fmt, header.fmt_size);
+  try {
+    header.format(fmt, args.begin_read() + sizeof(header), out);
+  } catch (...) {
+    out.clear();
+    out.append(fmt);
+  }
+}
+
+}  // namespace jt::log
@@ -11,6 +11,24 @@ struct formatter {
 
   virtual void format(const message& msg, detail::buffer_1k& buf,
                       std::size_t& color_start, std::size_t& color_stop) = 0;
+
+  // true 表示 format 可以在多个线程同时调用，
+  // sink 因此在锁外格式化，只有写入需要加锁
+  [[nodiscard]] virtual auto is_concurrent() const noexcept -> bool {
+    return false;
+  }
+
+  // 输出只由类型决定的 formatter 返回同一个非空值，
+  // logger 对返回值相同的多个 sink 只格式化一次；nullptr 表示不共享
+  [[nodiscard]] virtual auto share_key() const noexcept -> const void* {
+    return nullptr;
+  }
+
+  // true 表示输出是与 default_formatter 相同格式的纯文本行，
+  // 崩溃处理才会向这样的 sink 追加固定格式的纯文本
+  [[nodiscard]] virtual auto is_plain_text() const noexcept -> bool {
+    return false;
+  }
 };
 
 }  // namespace jt::log
\ No newline at end of file
@@ -1,6 +1,88 @@
 export module jt:log.functions;
 
+import std;
+import :detail.buffer;
+import :log.level;
 import :log.logger;
+import :log.deferred;
+import :log.site;
+
+namespace jt::log {
+
+// 返回 nullptr 表示不输出：低于 logger 的等级，且调用点没有单独开启
+inline auto enabled_site(const logger& logger, const level lv,
+                         const std::string_view fmt,
+                         const std::source_location& source) -> const site* {
+  if (logger.should_log(lv)) {
+    return &get_site(source, lv, fmt);
+  }
+
+  if (!has_enabled_sites()) return nullptr;
+
+  const auto& where = get_site(source, lv, fmt);
+  return where.enabled.load(std::memory_order::relaxed) ? &where : nullptr;
+}
+
+// 被 storm_control 丢弃的条数附在下一条输出的日志后面
+inline void append_suppressed(detail::buffer_1k& buf,
+                              const std::uint64_t suppressed) {
+  if (suppressed > 0) {
+    detail::format_to(buf, " ({} suppressed)", suppressed);
+  }
+}
+
+template <typename... Args>
+void format_and_log(const std::shared_ptr<logger>& logger,
+                    const std::uint32_t sid, const level lv,
+                    std::format_string<Args...> fmt, Args&&... args,
+                    const std::source_location& source) {
+  try {
+    const site* where = enabled_site(*logger, lv, fmt.get(), source);
+    if (where == nullptr) return;
+
+    std::uint64_t suppressed;
+    if (!logger->admit(*where, suppressed)) return;
+
+    detail::buffer_1k buf;
+    if constexpr (deferrable<Args...>) {
+      // 要附加丢弃条数时直接格式化；
+      // 保存到回溯缓冲区的日志多半不会输出，只编码参数
+      if (suppressed == 0 &&
+          (logger->is_deferred() || logger->backtraces(*where))) {
+        encode_deferred<Args...>(buf, fmt.get(), args...);
+        return logger->log_deferred(sid, *where, buf);
+      }
+    }
+
+    detail::format_to(buf, fmt, std::forward<Args>(args)...);
+    append_suppressed(buf, suppressed);
+    logger->log(sid, *where, buf);
+  } catch (...) {
+  }
+}
+
+// 运行时的格式字符串，调用点不记录 fmt
+inline void vformat_and_log(const std::shared_ptr<logger>& logger,
+                            const std::uint32_t sid, const level lv,
+                            const std::string_view fmt,
+                            const std::format_args args,
+                            const std::source_location& source) {
+  try {
+    const site* where = enabled_site(*logger, lv, {}, source);
+    if (where == nullptr) return;
+
+    std::uint64_t suppressed;
+    if (!logger->admit(*where, suppressed)) return;
+
+    detail::buffer_1k buf;
+    detail::vformat_to(buf, fmt, args);
+    append_suppressed(buf, suppressed);
+    logger->log(sid, *where, buf);
+  } catch (...) {
+  }
+}
+
+}  // namespace jt::log
 
 export namespace jt::log {
 
@@ -9,27 +91,19 @@ struct log {
   log(const std::shared_ptr<logger>& logger, const level lv,
       std::format_string<Args...> fmt, Args&&... args,
       const std::source_location& source = std::source_location::current()) {
-    if (!logger->should_log(lv)) return;
+    if (!is_active(lv)) return;
 
-    try {
-      detail::buffer_1k buf;
-      std::format_to(std::back_inserter(buf), fmt, std::forward<Args>(args)...);
-      logger->log(0, lv, buf, source);
-    } catch (...) {
-    }
+    format_and_log<Args...>(logger, 0, lv, fmt,
+                            std::forward<Args>(args)..., source);
   }
 
   log(const std::uint32_t sid, const std::shared_ptr<logger>& logger,
       const level lv, std::format_string<Args...> fmt, Args&&... args,
       const std::source_location& source = std::source_location::current()) {
-    if (!logger->should_log(lv)) return;
+    if (!is_active(lv)) return;
 
-    try {
-      detail::buffer_1k buf;
-      std::format_to(std::back_inserter(buf), fmt, std::forward<Args>(args)...);
-      logger->log(sid, lv, buf, source);
-    } catch (...) {
-    }
+    format_and_log<Args...>(logger, sid, lv, fmt,
+                            std::forward<Args>(args)..., source);
   }
 };
 
@@ -47,13 +121,9 @@ struct critical {
       const std::shared_ptr<logger>& logger, std::format_string<Args...> fmt,
       Args&&... args,
       const std::source_location& source = std::source_location::current()) {
-    if (!logger->should_log(level::critical)) return;
-
-    try {
-      detail::buffer_1k buf;
-      std::format_to(std::back_inserter(buf), fmt, std::forward<Args>(args)...);
-      logger->log(0, level::critical, buf, source);
-    } catch (...) {
+    if constexpr (is_active(level::critical)) {
+      format_and_log<Args...>(logger, 0, level::critical, fmt,
+                              std::forward<Args>(args)..., source);
     }
   }
 
@@ -61,13 +131,9 @@ struct critical {
       const std::uint32_t sid, const std::shared_ptr<logger>& logger,
       std::format_string<Args...> fmt, Args&&... args,
       const std::source_location& source = std::source_location::current()) {
-    if (!logger->should_log(level::critical)) return;
-
-    try {
-      detail::buffer_1k buf;
-      std::format_to(std::back_inserter(buf), fmt, std::forward<Args>(args)...);
-      logger->log(sid, level::critical, buf, source);
-    } catch (...) {
+    if constexpr (is_active(level::critical)) {
+      format_and_log<Args...>(logger, sid, level::critical, fmt,
+                              std::forward<Args>(args)..., source);
     }
   }
 };
@@ -85,26 +151,18 @@ struct error {
   error(const std::shared_ptr<logger>& logger, std::format_string<Args...> fmt,
         Args&&... args,
         const std::source_location& source = std::source_location::current()) {
-    if (!logger->should_log(level::error)) return;
-
-    try {
-      detail::buffer_1k buf;
-      std::format_to(std::back_inserter(buf), fmt, std::forward<Args>(args)...);
-      logger->log(0, level::error, buf, source);
-    } catch (...) {
+    if constexpr (is_active(level::error)) {
+      format_and_log<Args...>(logger, 0, level::error, fmt,
+                              std::forward<Args>(args)..., source);
     }
   }
 
   error(const std::uint32_t sid, const std::shared_ptr<logger>& logger,
         std::format_string<Args...> fmt, Args&&... args,
         const std::source_location& source = std::source_location::current()) {
-    if (!logger->should_log(level::error)) return;
-
-    try {
-      detail::buffer_1k buf;
-      std::format_to(std::back_inserter(buf), fmt, std::forward<Args>(args)...);
-      logger->log(sid, level::error, buf, source);
-    } catch (...) {
+    if constexpr (is_active(level::error)) {
+      format_and_log<Args...>(logger, sid, level::error, fmt,
+                              std::forward<Args>(args)..., source);
     }
   }
 };
@@ -122,26 +180,18 @@ struct warn {
   warn(const std::shared_ptr<logger>& logger, std::format_string<Args...> fmt,
        Args&&... args,
        const std::source_location& source = std::source_location::current()) {
-    if (!logger->should_log(level::warn)) return;
-
-    try {
-      detail::buffer_1k buf;
-      std::format_to(std::back_inserter(buf), fmt, std::forward<Args>(args)...);
-      logger->log(0, level::warn, buf, source);
-    } catch (...) {
+    if constexpr (is_active(level::warn)) {
+      format_and_log<Args...>(logger, 0, level::warn, fmt,
+                              std::forward<Args>(args)..., source);
     }
   }
 
   warn(const std::uint32_t sid, const std::shared_ptr<logger>& logger,
        std::format_string<Args...> fmt, Args&&... args,
        const std::source_location& source = std::source_location::current()) {
-    if (!logger->should_log(level::warn)) return;
-
-    try {
-      detail::buffer_1k buf;
-      std::format_to(std::back_inserter(buf), fmt, std::forward<Args>(args)...);
-      logger->log(sid, level::warn, buf, source);
-    } catch (...) {
+    if constexpr (is_active(level::warn)) {
+      format_and_log<Args...>(logger, sid, level::warn, fmt,
+                              std::forward<Args>(args)..., source);
     }
   }
 };
@@ -159,26 +209,18 @@ struct info {
   info(const std::shared_ptr<logger>& logger, std::format_string<Args...> fmt,
        Args&&... args,
        const std::source_location& source = std::source_location::current()) {
-    if (!logger->should_log(level::info)) return;
-
-    try {
-      detail::buffer_1k buf;
-      std::format_to(std::back_inserter(buf), fmt, std::forward<Args>(args)...);
-      logger->log(0, level::info, buf, source);
-    } catch (...) {
+    if constexpr (is_active(level::info)) {
+      format_and_log<Args...>(logger, 0, level::info, fmt,
+                              std::forward<Args>(args)..., source);
     }
   }
 
   info(const std::uint32_t sid, const std::shared_ptr<logger>& logger,
        std::format_string<Args...> fmt, Args&&... args,
        const std::source_location& source = std::source_location::current()) {
-    if (!logger->should_log(level::info)) return;
-
-    try {
-      detail::buffer_1k buf;
-      std::format_to(std::back_inserter(buf), fmt, std::forward<Args>(args)...);
-      logger->log(sid, level::info, buf, source);
-    } catch (...) {
+    if constexpr (is_active(level::info)) {
+      format_and_log<Args...>(logger, sid, level::info, fmt,
+                              std::forward<Args>(args)..., source);
     }
   }
 };
@@ -196,26 +238,18 @@ struct debug {
   debug(const std::shared_ptr<logger>& logger, std::format_string<Args...> fmt,
         Args&&... args,
         const std::source_location& source = std::source_location::current()) {
-    if (!logger->should_log(level::debug)) return;
-
-    try {
-      detail::buffer_1k buf;
-      std::format_to(std::back_inserter(buf), fmt, std::forward<Args>(args)...);
-      logger->log(0, level::debug, buf, source);
-    } catch (...) {
+    if constexpr (is_active(level::debug)) {
+      format_and_log<Args...>(logger, 0, level::debug, fmt,
+                              std::forward<Args>(args)..., source);
     }
   }
 
   debug(const std::uint32_t sid, const std::shared_ptr<logger>& logger,
         std::format_string<Args...> fmt, Args&&... args,
         const std::source_location& source = std::source_location::current()) {
-    if (!logger->should_log(level::debug)) return;
-
-    try {
-      detail::buffer_1k buf;
-      std::format_to(std::back_inserter(buf), fmt, std::forward<Args>(args)...);
-      logger->log(sid, level::debug, buf, source);
-    } catch (...) {
+    if constexpr (is_active(level::debug)) {
+      format_and_log<Args...>(logger, sid, level::debug, fmt,
+                              std::forward<Args>(args)..., source);
     }
   }
 };
@@ -233,26 +267,18 @@ struct trace {
   trace(const std::shared_ptr<logger>& logger, std::format_string<Args...> fmt,
         Args&&... args,
         const std::source_location& source = std::source_location::current()) {
-    if (!logger->should_log(level::trace)) return;
-
-    try {
-      detail::buffer_1k buf;
-      std::format_to(std::back_inserter(buf), fmt, std::forward<Args>(args)...);
-      logger->log(0, level::trace, buf, source);
-    } catch (...) {
+    if constexpr (is_active(level::trace)) {
+      format_and_log<Args...>(logger, 0, level::trace, fmt,
+                              std::forward<Args>(args)..., source);
     }
   }
 
   trace(const std::uint32_t sid, const std::shared_ptr<logger>& logger,
         std::format_string<Args...> fmt, Args&&... args,
         const std::source_location& source = std::source_location::current()) {
-    if (!logger->should_log(level::trace)) return;
-
-    try {
-      detail::buffer_1k buf;
-      std::format_to(std::back_inserter(buf), fmt, std::forward<Args>(args)...);
-      logger->log(sid, level::trace, buf, source);
-    } catch (...) {
+    if constexpr (is_active(level::trace)) {
+      format_and_log<Args...>(logger, sid, level::trace, fmt,
+                              std::forward<Args>(args)..., source);
     }
   }
 };
@@ -270,29 +296,19 @@ struct vlog {
   vlog(const std::shared_ptr<logger>& logger, const level lv,
        const std::string_view fmt, Args&&... args,
        const std::source_location& source = std::source_location::current()) {
-    if (!logger->should_log(lv)) return;
-
-    try {
-      detail::buffer_1k buf;
-      std::vformat_to(std::back_inserter(buf), fmt,
-                      std::make_format_args(args...));
-      logger->log(0, lv, buf, source);
-    } catch (...) {
-    }
+    if (!is_active(lv)) return;
+
+    vformat_and_log(logger, 0, lv, fmt, std::make_format_args(args...),
+                    source);
   }
 
   vlog(const std::uint32_t sid, const std::shared_ptr<logger>& logger,
        const level lv, const std::string_view fmt, Args&&... args,
        const std::source_location& source = std::source_location::current()) {
-    if (!logger->should_log(lv)) return;
-
-    try {
-      detail::buffer_1k buf;
-      std::vformat_to(std::back_inserter(buf), fmt,
-                      std::make_format_args(args...));
-      logger->log(sid, lv, buf, source);
-    } catch (...) {
-    }
+    if (!is_active(lv)) return;
+
+    vformat_and_log(logger, sid, lv, fmt, std::make_format_args(args...),
+                    source);
   }
 };
 
@@ -310,14 +326,9 @@ struct vcritical {
       const std::shared_ptr<logger>& logger, const std::string_view fmt,
       Args&&... args,
       const std::source_location& source = std::source_location::current()) {
-    if (!logger->should_log(level::critical)) return;
-
-    try {
-      detail::buffer_1k buf;
-      std::vformat_to(std::back_inserter(buf), fmt,
-                      std::make_format_args(args...));
-      logger->log(0, level::critical, buf, source);
-    } catch (...) {
+    if constexpr (is_active(level::critical)) {
+      vformat_and_log(logger, 0, level::critical, fmt,
+                      std::make_format_args(args...), source);
     }
   }
 
@@ -325,14 +336,9 @@ struct vcritical {
       const std::uint32_t sid, const std::shared_ptr<logger>& logger,
       const std::string_view fmt, Args&&... args,
       const std::source_location& source = std::source_location::current()) {
-    if (!logger->should_log(level::critical)) return;
-
-    try {
-      detail::buffer_1k buf;
-      std::vformat_to(std::back_inserter(buf), fmt,
-                      std::make_format_args(args...));
-      logger->log(sid, level::critical, buf, source);
-    } catch (...) {
+    if constexpr (is_active(level::critical)) {
+      vformat_and_log(logger, sid, level::critical, fmt,
+                      std::make_format_args(args...), source);
     }
   }
 };
@@ -350,28 +356,18 @@ struct verror {
   verror(const std::shared_ptr<logger>& logger, const std::string_view fmt,
          Args&&... args,
          const std::source_location& source = std::source_location::current()) {
-    if (!logger->should_log(level::error)) return;
-
-    try {
-      detail::buffer_1k buf;
-      std::vformat_to(std::back_inserter(buf), fmt,
-                      std::make_format_args(args...));
-      logger->log(0, level::error, buf, source);
-    } catch (...) {
+    if constexpr (is_active(level::error)) {
+      vformat_and_log(logger, 0, level::error, fmt,
+                      std::make_format_args(args...), source);
     }
   }
 
   verror(const std::uint32_t sid, const std::shared_ptr<logger>& logger,
          const std::string_view fmt, Args&&... args,
          const std::source_location& source = std::source_location::current()) {
-    if (!logger->should_log(level::error)) return;
-
-    try {
-      detail::buffer_1k buf;
-      std::vformat_to(std::back_inserter(buf), fmt,
-                      std::make_format_args(args...));
-      logger->log(sid, level::error, buf, source);
-    } catch (...) {
+    if constexpr (is_active(level::error)) {
+      vformat_and_log(logger, sid, level::error, fmt,
+                      std::make_format_args(args...), source);
     }
   }
 };
@@ -389,28 +385,18 @@ struct vwarn {
   vwarn(const std::shared_ptr<logger>& logger, const std::string_view fmt,
         Args&&... args,
         const std::source_location& source = std::source_location::current()) {
-    if (!logger->should_log(level::warn)) return;
-
-    try {
-      detail::buffer_1k buf;
-      std::vformat_to(std::back_inserter(buf), fmt,
-                      std::make_format_args(args...));
-      logger->log(0, level::warn, buf, source);
-    } catch (...) {
+    if constexpr (is_active(level::warn)) {
+      vformat_and_log(logger, 0, level::warn, fmt,
+                      std::make_format_args(args...), source);
     }
   }
 
   vwarn(const std::uint32_t sid, const std::shared_ptr<logger>& logger,
         const std::string_view fmt, Args&&... args,
         const std::source_location& source = std::source_location::current()) {
-    if (!logger->should_log(level::warn)) return;
-
-    try {
-      detail::buffer_1k buf;
-      std::vformat_to(std::back_inserter(buf), fmt,
-                      std::make_format_args(args...));
-      logger->log(sid, level::warn, buf, source);
-    } catch (...) {
+    if constexpr (is_active(level::warn)) {
+      vformat_and_log(logger, sid, level::warn, fmt,
+                      std::make_format_args(args...), source);
     }
   }
 };
@@ -428,28 +414,18 @@ struct vinfo {
   vinfo(const std::shared_ptr<logger>& logger, const std::string_view fmt,
         Args&&... args,
         const std::source_location& source = std::source_location::current()) {
-    if (!logger->should_log(level::info)) return;
-
-    try {
-      detail::buffer_1k buf;
-      std::vformat_to(std::back_inserter(buf), fmt,
-                      std::make_format_args(args...));
-      logger->log(0, level::info, buf, source);
-    } catch (...) {
+    if constexpr (is_active(level::info)) {
+      vformat_and_log(logger, 0, level::info, fmt,
+                      std::make_format_args(args...), source);
     }
   }
 
   vinfo(const std::uint32_t sid, const std::shared_ptr<logger>& logger,
         const std::string_view fmt, Args&&... args,
         const std::source_location& source = std::source_location::current()) {
-    if (!logger->should_log(level::info)) return;
-
-    try {
-      detail::buffer_1k buf;
-      std::vformat_to(std::back_inserter(buf), fmt,
-                      std::make_format_args(args...));
-      logger->log(sid, level::info, buf, source);
-    } catch (...) {
+    if constexpr (is_active(level::info)) {
+      vformat_and_log(logger, sid, level::info, fmt,
+                      std::make_format_args(args...), source);
     }
   }
 };
@@ -467,28 +443,18 @@ struct vtrace {
   vtrace(const std::shared_ptr<logger>& logger, const std::string_view fmt,
          Args&&... args,
          const std::source_location& source = std::source_location::current()) {
-    if (!logger->should_log(level::trace)) return;
-
-    try {
-      detail::buffer_1k buf;
-      std::vformat_to(std::back_inserter(buf), fmt,
-                      std::make_format_args(args...));
-      logger->log(0, level::trace, buf, source);
-    } catch (...) {
+    if constexpr (is_active(level::trace)) {
+      vformat_and_log(logger, 0, level::trace, fmt,
+                      std::make_format_args(args...), source);
     }
   }
 
   vtrace(const std::uint32_t sid, const std::shared_ptr<logger>& logger,
          const std::string_view fmt, Args&&... args,
          const std::source_location& source = std::source_location::current()) {
-    if (!logger->should_log(level::trace)) return;
-
-    try {
-      detail::buffer_1k buf;
-      std::vformat_to(std::back_inserter(buf), fmt,
-                      std::make_format_args(args...));
-      logger->log(sid, level::trace, buf, source);
-    } catch (...) {
+    if constexpr (is_active(level::trace)) {
+      vformat_and_log(logger, sid, level::trace, fmt,
+                      std::make_format_args(args...), source);
     }
   }
 };
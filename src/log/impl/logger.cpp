@@ -4,7 +4,11 @@ module jt;
 import std;
 import :detail.string;
 import :detail.vector;
+import :detail.deque;
+import :detail.file;
+import :detail.unordered_map;
 import :log.message;
+import :log.deferred;
 
 namespace jt::log {
 
@@ -17,34 +21,280 @@ class logger_impl {
         sinks_(std::move(sinks)),
         async_(async) {}
 
+  ~logger_impl() noexcept {
+    const detail::unique_ptr<storm_table> table{storm_sites_.load()};
+    try {
+      backend_flush_suppressed();
+    } catch (...) {
+    }
+    // 风暴结束后没有新日志时，汇总行还没输出
+    if (const message* summary = take_summary()) {
+      write(*summary);
+    }
+  }
+
   void set_level(const level lv) noexcept {
     lv_.store(lv, std::memory_order::relaxed);
+    update_log_level();
   }
 
   [[nodiscard]] auto get_level() const noexcept -> level {
     return lv_.load(std::memory_order::relaxed);
   }
 
+  // 包含回溯缓冲区的等级
+  [[nodiscard]] auto get_log_level() const noexcept -> level {
+    return log_lv_.load(std::memory_order::relaxed);
+  }
+
   [[nodiscard]] auto get_name() const noexcept -> std::string_view {
     return name_;
   }
 
   [[nodiscard]] auto is_async() const noexcept -> bool { return async_; }
 
+  void set_deferred(const bool deferred) noexcept {
+    deferred_.store(deferred, std::memory_order::relaxed);
+  }
+
+  [[nodiscard]] auto is_deferred() const noexcept -> bool {
+    return async_ && deferred_.load(std::memory_order::relaxed);
+  }
+
+  void set_shard_key(const std::uint32_t key) noexcept { shard_key_ = key; }
+
+  [[nodiscard]] auto shard_key() const noexcept -> std::uint32_t {
+    return shard_key_;
+  }
+
+  void set_handle(const std::uint32_t handle) noexcept {
+    handle_.store(handle, std::memory_order::relaxed);
+  }
+
+  [[nodiscard]] auto handle() const noexcept -> std::uint32_t {
+    return handle_.load(std::memory_order::relaxed);
+  }
+
   [[nodiscard]] auto get_service() const noexcept -> service& {
     return service_;
   }
 
-  void backend_log(const message& msg) const {
+  void set_storm_control(const storm_control& control) {
+    if (storm_sites_.load(std::memory_order::acquire) == nullptr &&
+        (control.rate > 0 || control.sample > 1)) {
+      // 只在第一次开启时分配，之后一直保留到 logger 析构
+      std::scoped_lock lock{storm_mutex_};
+      if (storm_sites_.load(std::memory_order::relaxed) == nullptr) {
+        storm_sites_.store(detail::make_unique<storm_table>().release(),
+                           std::memory_order::release);
+      }
+    }
+    rate_.store(control.rate, std::memory_order::relaxed);
+    burst_.store((std::max)(control.burst, 1u), std::memory_order::relaxed);
+    sample_.store(control.sample, std::memory_order::relaxed);
+    dedup_.store(control.dedup, std::memory_order::relaxed);
+    limited_.store(control.rate > 0 || control.sample > 1,
+                   std::memory_order::release);
+  }
+
+  [[nodiscard]] auto get_storm_control() const noexcept -> storm_control {
+    return {rate_.load(std::memory_order::relaxed),
+            burst_.load(std::memory_order::relaxed),
+            sample_.load(std::memory_order::relaxed),
+            dedup_.load(std::memory_order::relaxed)};
+  }
+
+  [[nodiscard]] auto get_storm_stats() const noexcept -> storm_stats {
+    return {rate_limited_.load(std::memory_order::relaxed),
+            sampled_.load(std::memory_order::relaxed),
+            duplicates_.load(std::memory_order::relaxed)};
+  }
+
+  void set_backtrace(const backtrace_config& config) {
+    const auto capacity = (std::max)(config.capacity, 1u);
+    backtrace_lv_.store(level::off, std::memory_order::relaxed);
+    for (auto& shard : backtrace_) {
+      std::scoped_lock lock{shard.mutex};
+      shard.rings.clear();
+      shard.capacity = capacity;
+    }
+    backtrace_trigger_.store(config.trigger, std::memory_order::relaxed);
+    backtrace_capacity_.store(capacity, std::memory_order::relaxed);
+    backtrace_by_sid_.store(config.by_sid, std::memory_order::relaxed);
+    backtrace_lv_.store(config.lv, std::memory_order::relaxed);
+    update_log_level();
+  }
+
+  [[nodiscard]] auto get_backtrace() const noexcept -> backtrace_config {
+    return {backtrace_lv_.load(std::memory_order::relaxed),
+            backtrace_trigger_.load(std::memory_order::relaxed),
+            backtrace_capacity_.load(std::memory_order::relaxed),
+            backtrace_by_sid_.load(std::memory_order::relaxed)};
+  }
+
+  // 这个调用点的日志只会保存到回溯缓冲区
+  [[nodiscard]] auto backtraces(const site& where) const noexcept -> bool {
+    if (backtrace_lv_.load(std::memory_order::relaxed) == level::off) {
+      return false;
+    }
+    const auto lv = lv_.load(std::memory_order::relaxed);
+    return static_cast<std::uint8_t>(where.lv) >
+               static_cast<std::uint8_t>(lv) &&
+           !where.enabled.load(std::memory_order::relaxed);
+  }
+
+  // 返回 true 表示日志已经保存到回溯缓冲区；
+  // 达到触发等级时先把同一线程（或 sid）保存的日志交给 self 输出
+  auto backtrace(logger& self, const std::uint32_t sid, const site& where,
+                 detail::buffer_1k& buf, const bool deferred) -> bool {
+    if (backtrace_lv_.load(std::memory_order::relaxed) == level::off) {
+      return false;
+    }
+
+    const auto tid = detail::tid();
+    if (backtraces(where)) {
+      backtrace_record(sid, tid, where, buf, deferred);
+      return true;
+    }
+
+    if (const auto trigger =
+            backtrace_trigger_.load(std::memory_order::relaxed);
+        trigger != level::off && static_cast<std::uint8_t>(where.lv) <=
+                                     static_cast<std::uint8_t>(trigger)) {
+      backtrace_dump(self, sid, tid, where.lv);
+    }
+    return false;
+  }
+
+  auto admit(const site& where, std::uint64_t& suppressed) noexcept -> bool {
+    suppressed = 0;
+    if (!limited_.load(std::memory_order::acquire)) return true;
+
+    auto& state = storm_state(where);
+    if (const auto sample = sample_.load(std::memory_order::relaxed);
+        sample > 1 &&
+        state.hits.fetch_add(1, std::memory_order::relaxed) % sample != 0) {
+      state.suppressed.fetch_add(1, std::memory_order::relaxed);
+      sampled_.fetch_add(1, std::memory_order::relaxed);
+      return false;
+    }
+
+    if (const auto rate = rate_.load(std::memory_order::relaxed);
+        rate > 0 && !take_token(state, rate)) {
+      state.suppressed.fetch_add(1, std::memory_order::relaxed);
+      rate_limited_.fetch_add(1, std::memory_order::relaxed);
+      return false;
+    }
+
+    if (state.suppressed.load(std::memory_order::relaxed) != 0) {
+      suppressed = state.suppressed.exchange(0, std::memory_order::relaxed);
+    }
+    return true;
+  }
+
+  // 风暴停止后没有日志可以附带丢弃条数，每个调用点单独输出一行
+  void backend_flush_suppressed() {
+    auto* table = storm_sites_.load(std::memory_order::acquire);
+    if (table == nullptr) return;
+
+    bool written = false;
+    const auto report = [&](storm_site& state) {
+      if (state.suppressed.load(std::memory_order::relaxed) == 0) return;
+
+      const site* where = state.where.load(std::memory_order::acquire);
+      if (where == nullptr) return;
+
+      const auto count =
+          state.suppressed.exchange(0, std::memory_order::relaxed);
+      if (count == 0) return;
+
+      message msg;
+      msg.lv = where->lv;
+      msg.where = where;
+      msg.point = std::chrono::system_clock::now();
+      msg.tid = detail::tid();
+      detail::format_to(msg.buf, "{} messages suppressed", count);
+      backend_log(msg);
+      written = true;
+    };
+    for (auto& state : table->sites) {
+      report(state);
+    }
+    report(table->overflow);
+
+    if (written) backend_end_batch();
+  }
+
+  void backend_log(const message& msg) {
+    if (!dedup_.load(std::memory_order::relaxed)) {
+      return write(msg);
+    }
+
+    // 同步 logger 由多个调用线程进入
+    std::unique_lock lock(dedup_mutex_, std::defer_lock);
+    if (!async_) lock.lock();
+
+    if (is_repeat(msg)) {
+      if (const message* summary = take_summary_due(msg)) {
+        write(*summary);
+      }
+      return;
+    }
+
+    if (const message* summary = take_summary()) {
+      write(*summary);
+    }
+    remember(msg);
+    return write(msg);
+  }
+
+  void backend_log_batch(const std::span<const message* const> msgs) {
+    if (!dedup_.load(std::memory_order::relaxed)) {
+      return write_batch(msgs);
+    }
+
+    // 只有异步 logger 的写线程会进入
+    dedup_batch_.clear();
+    dedup_summaries_.clear();
+    for (const message* msg : msgs) {
+      const bool repeat = is_repeat(*msg);
+      if (const message* summary =
+              repeat ? take_summary_due(*msg) : take_summary()) {
+        auto& copy = dedup_summaries_.emplace_back();
+        copy_message(*summary, copy);
+        dedup_batch_.push_back(&copy);
+      }
+
+      if (!repeat) {
+        remember(*msg);
+        dedup_batch_.push_back(msg);
+      }
+    }
+
+    if (dedup_batch_.empty()) return;
+
+    return write_batch(dedup_batch_);
+  }
+
+  void backend_flush() {
+    if (dedup_.load(std::memory_order::relaxed)) {
+      std::unique_lock lock(dedup_mutex_, std::defer_lock);
+      if (!async_) lock.lock();
+      if (const message* summary = take_summary()) {
+        write(*summary);
+      }
+    }
+
     for (const auto& sink : sinks_) {
       try {
-        sink->log(msg);
+        sink->flush();
       } catch (...) {
       }
     }
   }
 
-  void backend_flush() const {
+  void backend_write_through(const message& msg) const {
+    write(msg);
     for (const auto& sink : sinks_) {
       try {
         sink->flush();
@@ -53,18 +303,479 @@ class logger_impl {
     }
   }
 
+  auto backend_end_batch() -> std::chrono::steady_clock::time_point {
+    if (dedup_.load(std::memory_order::relaxed)) {
+      std::unique_lock lock(dedup_mutex_, std::defer_lock);
+      if (!async_) lock.lock();
+      if (repeats_ > 0 && std::chrono::system_clock::now() - first_repeat_ >=
+                              std::chrono::seconds(1)) {
+        write(*take_summary());
+      }
+    }
+
+    auto next = std::chrono::steady_clock::time_point::max();
+    for (const auto& sink : sinks_) {
+      try {
+        next = (std::min)(next, sink->end_batch());
+      } catch (...) {
+      }
+    }
+    return next;
+  }
+
+  auto backend_sync() -> std::chrono::steady_clock::time_point {
+    auto next = std::chrono::steady_clock::time_point::max();
+    for (const auto& sink : sinks_) {
+      try {
+        next = (std::min)(next, sink->sync());
+      } catch (...) {
+      }
+    }
+    return next;
+  }
+
+  void backend_crash_prepare() noexcept {
+    if (crash_prepared_) return;
+    crash_prepared_ = true;
+    for (const auto& sink : sinks_) {
+      if (crash_fd_count_ == crash_fds_.size()) break;
+      // JSON 或自定义格式的文件追加纯文本会破坏格式
+      if (!sink->is_plain_text()) continue;
+
+      if (const int fd = sink->crash_prepare(); fd >= 0) {
+        crash_fds_[crash_fd_count_++] = fd;
+      }
+    }
+  }
+
+  // 不分配内存，不使用 formatter，格式固定：
+  // [crash] 毫秒时间戳 [等级] [线程] [文件:行] 内容
+  void backend_crash_write(const message& msg,
+                           const sink::time_point point) noexcept {
+    backend_crash_prepare();
+    if (crash_fd_count_ == 0 || msg.where == nullptr) return;
+
+    std::array<char, 2048> line;  // NOLINT(*-member-init)
+    char* const end = line.data() + line.size() - 1;
+    char* out = line.data();
+    const auto put = [&out, end](const std::string_view text) {
+      const auto n = (std::min)(text.size(),
+                                static_cast<std::size_t>(end - out));
+      std::memcpy(out, text.data(), n);
+      out += n;
+    };
+    const auto put_number = [&out, end](const auto value) {
+      out = std::to_chars(out, end, value).ptr;
+    };
+
+    put("[crash] ");
+    put_number(std::chrono::duration_cast<std::chrono::milliseconds>(
+                   point.time_since_epoch())
+                   .count());
+    put(" [");
+    put(to_string_view(msg.where->lv));
+    put("] [");
+    put_number(msg.tid);
+    put("] [");
+    put(msg.where->file_name);
+    put(":");
+    put_number(msg.where->line);
+    put("] ");
+    if (msg.type == message_type::deferred) {
+      // 参数无法安全格式化，只输出格式串
+      deferred_header header;  // NOLINT(*-member-init)
+      if (msg.buf.readable() >= sizeof(header)) {
+        std::memcpy(&header, msg.buf.begin_read(), sizeof(header));
+        put({header.fmt, header.fmt_size});
+      }
+    } else {
+      put({msg.buf.begin_read(), msg.buf.readable()});
+    }
+    *out++ = '\n';
+
+    const auto size = static_cast<std::size_t>(out - line.data());
+    for (std::size_t i = 0; i < crash_fd_count_; ++i) {
+      detail::write_fd(crash_fds_[i], line.data(), size);
+    }
+  }
+
  private:
+  // 一个 logger 在一个调用点上的限速状态
+  struct storm_site {
+    std::atomic<const site*> where{nullptr};
+    // 令牌桶（GCRA）的理论到达时间，steady_clock 的纳秒
+    std::atomic<std::uint64_t> tat{0};
+    // 采样计数
+    std::atomic<std::uint64_t> hits{0};
+    // 上次输出之后被限速或采样丢弃的条数
+    std::atomic<std::uint64_t> suppressed{0};
+  };
+
+  struct storm_table {
+    std::array<storm_site, 1024> sites{};
+    storm_site overflow{};
+  };
+
+  static constexpr std::size_t storm_probe_limit = 16;
+
+  // write 在栈上记录 share_key 的 sink 数
+  static constexpr std::size_t max_shared_sinks = 16;
+
+  struct backtrace_ring {
+    detail::deque<message> lines;
+    // 下一条写入的位置，写满后也是最旧的一条
+    std::size_t next{0};
+    // 最后一次写入的序号
+    std::uint64_t touched{0};
+  };
+
+  // 每个线程（或 sid）一个环，按 key 分片加锁
+  struct backtrace_shard {
+    std::mutex mutex;
+    detail::unordered_map<std::uint64_t, backtrace_ring> rings;
+    std::uint64_t clock{0};
+    std::size_t capacity{0};
+  };
+
+  // 线程退出后它的环不会被输出，环太多时丢弃最久没有写入的
+  static constexpr std::size_t backtrace_ring_limit = 64;
+
+  void update_log_level() noexcept {
+    const auto lv = lv_.load(std::memory_order::relaxed);
+    const auto backtrace_lv = backtrace_lv_.load(std::memory_order::relaxed);
+    log_lv_.store((std::max)(lv, backtrace_lv), std::memory_order::relaxed);
+  }
+
+  [[nodiscard]] auto backtrace_key(const std::uint32_t sid,
+                                   const std::uint64_t tid) const noexcept
+      -> std::uint64_t {
+    return backtrace_by_sid_.load(std::memory_order::relaxed) ? sid : tid;
+  }
+
+  void backtrace_record(const std::uint32_t sid, const std::uint64_t tid,
+                        const site& where, detail::buffer_1k& buf,
+                        const bool deferred) {
+    const auto key = backtrace_key(sid, tid);
+    auto& shard = backtrace_[key % backtrace_.size()];
+    std::scoped_lock lock{shard.mutex};
+    if (shard.capacity == 0) return;
+
+    auto it = shard.rings.find(key);
+    if (it == shard.rings.end()) {
+      if (shard.rings.size() >= backtrace_ring_limit) {
+        shard.rings.erase(std::ranges::min_element(
+            shard.rings, {},
+            [](const auto& entry) { return entry.second.touched; }));
+      }
+      it = shard.rings.try_emplace(key).first;
+    }
+
+    auto& ring = it->second;
+    ring.touched = ++shard.clock;
+    message* line;
+    if (ring.lines.size() < shard.capacity) {
+      line = &ring.lines.emplace_back();
+    } else {
+      line = &ring.lines[ring.next];
+    }
+    ring.next = (ring.next + 1) % shard.capacity;
+
+    line->type = deferred ? message_type::deferred : message_type::log;
+    line->lv = where.lv;
+    line->sid = sid;
+    line->tid = tid;
+    line->point = std::chrono::system_clock::now();
+    line->where = &where;
+    line->buf = std::move(buf);
+  }
+
+  // 按时间顺序输出并移除同一线程（或 sid）的日志
+  void backtrace_dump(logger& self, const std::uint32_t sid,
+                      const std::uint64_t tid, const level trigger) {
+    const auto key = backtrace_key(sid, tid);
+    auto& shard = backtrace_[key % backtrace_.size()];
+    std::scoped_lock lock{shard.mutex};
+    const auto it = shard.rings.find(key);
+    if (it == shard.rings.end()) return;
+
+    auto& ring = it->second;
+    const auto size = ring.lines.size();
+    const auto oldest = size < shard.capacity ? 0 : ring.next;
+    for (std::size_t i = 0; i < size; ++i) {
+      auto& line = ring.lines[(oldest + i) % size];
+      if (line.where == nullptr) continue;
+
+      if (async_) {
+        service_.log_backtrace(self, line, trigger);
+      } else if (line.type == message_type::deferred) {
+        // 同步 logger 没有写线程，在这里展开参数
+        detail::buffer_1k text;
+        format_deferred(line.buf, text);
+        std::swap(line.buf, text);
+        line.type = message_type::log;
+        line.args = &text;
+        backend_log(line);
+        line.args = nullptr;
+      } else {
+        backend_log(line);
+      }
+      line.where = nullptr;
+      line.buf.clear();
+    }
+    shard.rings.erase(it);
+  }
+
+  // share_key 相同的 sink 只格式化一次，各组在组内第一个 sink 处写出；
+  // 超过 max_shared_sinks 的 sink 各自格式化
+  void write(const message& msg) const {
+    if (sinks_.size() == 1) {
+      try {
+        sinks_.front()->log(msg);
+      } catch (...) {
+      }
+      return;
+    }
+
+    std::array<const void*, max_shared_sinks> keys{};
+    const auto count = (std::min)(sinks_.size(), keys.size());
+    for (std::size_t i = 0; i < count; ++i) {
+      keys[i] = sinks_[i]->share_key();
+    }
+
+    detail::buffer_1k buf;
+    std::size_t color_start{0}, color_stop{0};
+    for (std::size_t i = 0; i < sinks_.size(); ++i) {
+      try {
+        if (i >= count || keys[i] == nullptr) {
+          sinks_[i]->log(msg);
+          continue;
+        }
+
+        const auto grouped = [&](const std::size_t j) {
+          return keys[j] == keys[i] && sinks_[j]->should_log(msg.lv);
+        };
+        if (std::ranges::contains(keys.begin(), keys.begin() + i, keys[i]) ||
+            std::ranges::none_of(std::views::iota(i, count), grouped)) {
+          continue;
+        }
+
+        buf.clear();
+        sinks_[i]->format(msg, buf, color_start, color_stop);
+        for (std::size_t j = i; j < count; ++j) {
+          if (keys[j] != keys[i]) continue;
+
+          try {
+            sinks_[j]->log_formatted(msg.lv, msg.point, buf, color_start,
+                                     color_stop);
+          } catch (...) {
+          }
+        }
+      } catch (...) {
+      }
+    }
+  }
+
+  // 只在写线程调用，分组方式同 write
+  void write_batch(const std::span<const message* const> msgs) {
+    if (sinks_.size() == 1) {
+      try {
+        sinks_.front()->log_batch(msgs);
+      } catch (...) {
+      }
+      return;
+    }
+
+    shared_keys_.clear();
+    for (const auto& sink : sinks_) {
+      shared_keys_.push_back(sink->share_key());
+    }
+
+    for (std::size_t i = 0; i < sinks_.size(); ++i) {
+      const void* key = shared_keys_[i];
+      try {
+        if (key == nullptr) {
+          sinks_[i]->log_batch(msgs);
+          continue;
+        }
+        if (std::ranges::contains(shared_keys_.begin(),
+                                  shared_keys_.begin() + i, key)) {
+          continue;
+        }
+
+        format_batch(*sinks_[i], msgs);
+        for (std::size_t j = i; j < sinks_.size(); ++j) {
+          if (shared_keys_[j] != key) continue;
+
+          try {
+            sinks_[j]->log_batch_formatted(shared_lines_, shared_buf_);
+          } catch (...) {
+          }
+        }
+      } catch (...) {
+      }
+    }
+  }
+
+  void format_batch(sink& s, const std::span<const message* const> msgs) {
+    shared_buf_.clear();
+    shared_lines_.clear();
+    for (const message* msg : msgs) {
+      sink::batch_line line{msg->lv, msg->point, shared_buf_.readable()};
+      s.format(*msg, shared_buf_, line.color_start, line.color_stop);
+      line.stop = shared_buf_.readable();
+      shared_lines_.push_back(line);
+    }
+  }
+
+  // 按 site 指针开放寻址，找不到空位的调用点共用 overflow
+  auto storm_state(const site& where) noexcept -> storm_site& {
+    auto& table = *storm_sites_.load(std::memory_order::acquire);
+    const auto hash = std::bit_cast<std::uintptr_t>(&where) *
+                      std::uintptr_t{0x9e3779b97f4a7c15ull};
+    for (std::size_t i = 0; i < storm_probe_limit; ++i) {
+      auto& state = table.sites[(hash + i) % table.sites.size()];
+      const site* key = state.where.load(std::memory_order::acquire);
+      // 失败时 key 为其他线程抢先写入的调用点
+      if (key == nullptr && state.where.compare_exchange_strong(
+                                key, &where, std::memory_order::acq_rel)) {
+        return state;
+      }
+      if (key == &where) return state;
+    }
+
+    table.overflow.where.store(&where, std::memory_order::release);
+    return table.overflow;
+  }
+
+  // GCRA 令牌桶，每 interval 补充一个令牌，最多积累 burst 个
+  auto take_token(storm_site& state, const std::uint32_t rate) const noexcept
+      -> bool {
+    using namespace std::chrono;
+    const auto now = static_cast<std::uint64_t>(
+        duration_cast<nanoseconds>(steady_clock::now().time_since_epoch())
+            .count());
+    const auto interval =
+        (std::max)(std::uint64_t{1'000'000'000} / rate, std::uint64_t{1});
+    const auto limit = interval * burst_.load(std::memory_order::relaxed);
+    auto tat = state.tat.load(std::memory_order::relaxed);
+    while (true) {
+      const auto next = (std::max)(tat, now) + interval;
+      if (next - now > limit) return false;
+
+      if (state.tat.compare_exchange_weak(tat, next,
+                                          std::memory_order::relaxed)) {
+        return true;
+      }
+    }
+  }
+
+  // 与上一条日志的调用点、服务id和内容都相同时只计数
+  auto is_repeat(const message& msg) -> bool {
+    if (msg.where == nullptr || msg.where != last_.where ||
+        msg.sid != last_.sid ||
+        static_cast<std::string_view>(msg.buf) !=
+            static_cast<std::string_view>(last_.buf)) {
+      return false;
+    }
+
+    if (repeats_++ == 0) {
+      first_repeat_ = msg.point;
+    }
+    last_.tid = msg.tid;
+    last_.point = msg.point;
+    duplicates_.fetch_add(1, std::memory_order::relaxed);
+    return true;
+  }
+
+  static void copy_message(const message& from, message& to) {
+    to.type = from.type;
+    to.lv = from.lv;
+    to.sid = from.sid;
+    to.tid = from.tid;
+    to.point = from.point;
+    to.where = from.where;
+    to.buf.clear();
+    to.buf.append(from.buf.begin_read(), from.buf.readable());
+  }
+
+  void remember(const message& msg) { copy_message(msg, last_); }
+
+  // 有被合并的日志时生成汇总行
+  auto take_summary() -> const message* {
+    if (repeats_ == 0) return nullptr;
+
+    copy_message(last_, summary_);
+    summary_.buf.clear();
+    detail::format_to(summary_.buf, "last message repeated {} times",
+                      repeats_);
+    repeats_ = 0;
+    return &summary_;
+  }
+
+  // 风暴持续时每秒输出一次汇总行
+  auto take_summary_due(const message& msg) -> const message* {
+    if (msg.point - first_repeat_ < std::chrono::seconds(1)) return nullptr;
+
+    return take_summary();
+  }
+
   service& service_;
   detail::string name_;
   detail::vector<service::sink_ptr> sinks_;
   std::atomic<level> lv_{level::trace};
+  // lv_ 和 backtrace_lv_ 中较详细的一个
+  std::atomic<level> log_lv_{level::trace};
+  std::atomic<bool> deferred_{false};
+  // service 据此选择写线程
+  std::uint32_t shard_key_{0};
+  // service 先于 logger 销毁时置 0，析构时不再访问 service
+  std::atomic<std::uint32_t> handle_{0};
   bool async_;
+
+  std::atomic<bool> limited_{false};
+  std::atomic<std::uint32_t> rate_{0};
+  std::atomic<std::uint32_t> burst_{1};
+  std::atomic<std::uint32_t> sample_{0};
+  std::atomic<std::uint64_t> rate_limited_{0};
+  std::atomic<std::uint64_t> sampled_{0};
+  std::atomic<storm_table*> storm_sites_{nullptr};
+  std::mutex storm_mutex_;
+
+  std::atomic<bool> dedup_{false};
+  std::atomic<std::uint64_t> duplicates_{0};
+  std::mutex dedup_mutex_;
+  message last_;
+  message summary_;
+  std::uint64_t repeats_{0};
+  std::chrono::system_clock::time_point first_repeat_{};
+  detail::vector<const message*> dedup_batch_;
+  detail::deque<message> dedup_summaries_;
+
+  std::atomic<level> backtrace_lv_{level::off};
+  std::atomic<level> backtrace_trigger_{level::error};
+  std::atomic<std::uint32_t> backtrace_capacity_{32};
+  std::atomic<bool> backtrace_by_sid_{false};
+  std::array<backtrace_shard, 16> backtrace_{};
+
+  // write_batch 共享的格式化结果
+  detail::vector<const void*> shared_keys_;
+  detail::buffer_1k shared_buf_;
+  detail::vector<sink::batch_line> shared_lines_;
+
+  bool crash_prepared_{false};
+  std::array<int, 8> crash_fds_{};
+  std::size_t crash_fd_count_{0};
 };
 
 logger::logger(service& service, const std::string_view& name,  // NOLINT
                detail::vector<sink_ptr> sinks, bool async)
     : impl_(detail::make_unique<logger_impl>(service, name, sinks, async)) {}
-logger::~logger() noexcept = default;
+logger::~logger() noexcept {
+  // 等写线程不再使用这个 logger 之后才析构
+  if (const auto handle = impl_->handle(); handle != 0) {
+    impl_->get_service().release_handle(handle);
+  }
+}
 
 // ReSharper disable once CppMemberFunctionMayBeConst
 void logger::set_level(const level lv) noexcept { return impl_->set_level(lv); }
@@ -80,36 +791,158 @@ void logger::flush() {  // NOLINT(*-convert-member-functions-to-static)
     return impl_->backend_flush();
   }
 
-  return impl_->get_service().flush(weak_from_this());
+  return impl_->get_service().flush(*this);
+}
+
+auto logger::flush_and_wait() -> std::future<void> {
+  if (!impl_->is_async()) {
+    impl_->backend_flush();
+    std::promise<void> done;
+    done.set_value();
+    return done.get_future();
+  }
+
+  return impl_->get_service().flush_and_wait(*this);
 }
 
 auto logger::should_log(level lv) const noexcept -> bool {
   return static_cast<std::uint8_t>(lv) <=
-         static_cast<std::uint8_t>(impl_->get_level());
+         static_cast<std::uint8_t>(impl_->get_log_level());
 }
 
-void logger::log(std::uint32_t sid, level lv, detail::buffer_1k& buf,  // NOLINT
-                 const std::source_location& source) {
+// ReSharper disable once CppMemberFunctionMayBeConst
+void logger::set_deferred(const bool deferred) noexcept {
+  return impl_->set_deferred(deferred);
+}
+
+auto logger::is_deferred() const noexcept -> bool {
+  return impl_->is_deferred();
+}
+
+void logger::log(const std::uint32_t sid, const site& where,  // NOLINT
+                 detail::buffer_1k& buf) {
+  if (impl_->backtrace(*this, sid, where, buf, false)) return;
+
   auto& service = impl_->get_service();
   if (!impl_->is_async()) {
     message msg;
     msg.buf = std::move(buf);
-    msg.source = source;
-    msg.lv = lv;
+    msg.where = &where;
+    msg.lv = where.lv;
     msg.sid = sid;
     msg.point = std::chrono::system_clock::now();
     msg.type = message_type::log;
     msg.tid = detail::tid();
-    return impl_->backend_log(msg);
+    impl_->backend_log(msg);
+    impl_->backend_end_batch();
+    return;
   }
 
-  return service.log(weak_from_this(), sid, lv, buf, source);
+  return service.log(*this, sid, where, buf);
+}
+
+void logger::log_deferred(const std::uint32_t sid, const site& where,  // NOLINT
+                          detail::buffer_1k& buf) {
+  if (impl_->backtrace(*this, sid, where, buf, true)) return;
+
+  if (!impl_->is_async()) {
+    detail::buffer_1k text;
+    format_deferred(buf, text);
+    return log(sid, where, text);
+  }
+
+  return impl_->get_service().log(*this, sid, where, buf, true);
+}
+
+auto logger::backtraces(const site& where) const noexcept -> bool {
+  return impl_->backtraces(where);
+}
+
+// ReSharper disable once CppMemberFunctionMayBeConst
+void logger::set_storm_control(const storm_control& control) {
+  return impl_->set_storm_control(control);
+}
+
+auto logger::get_storm_control() const noexcept -> storm_control {
+  return impl_->get_storm_control();
+}
+
+auto logger::get_storm_stats() const noexcept -> storm_stats {
+  return impl_->get_storm_stats();
+}
+
+// ReSharper disable once CppMemberFunctionMayBeConst
+void logger::set_backtrace(const backtrace_config& config) {
+  return impl_->set_backtrace(config);
+}
+
+auto logger::get_backtrace() const noexcept -> backtrace_config {
+  return impl_->get_backtrace();
+}
+
+// ReSharper disable once CppMemberFunctionMayBeConst
+auto logger::admit(const site& where, std::uint64_t& suppressed) noexcept
+    -> bool {
+  return impl_->admit(where, suppressed);
+}
+
+// ReSharper disable once CppMemberFunctionMayBeConst
+void logger::set_shard_key(const std::uint32_t key) noexcept {
+  return impl_->set_shard_key(key);
+}
+
+void logger::set_handle(const std::uint32_t handle) noexcept {
+  return impl_->set_handle(handle);
+}
+
+auto logger::handle() const noexcept -> std::uint32_t {
+  return impl_->handle();
+}
+
+auto logger::shard_key() const noexcept -> std::uint32_t {
+  return impl_->shard_key();
 }
 
 // ReSharper disable once CppMemberFunctionMayBeConst
 void logger::backend_log(const message& msg) { return impl_->backend_log(msg); }
 
+// ReSharper disable once CppMemberFunctionMayBeConst
+void logger::backend_log_batch(const std::span<const message* const> msgs) {
+  return impl_->backend_log_batch(msgs);
+}
+
 // ReSharper disable once CppMemberFunctionMayBeConst
 void logger::backend_flush() { return impl_->backend_flush(); }
 
-}  // namespace jt::log
\ No newline at end of file
+// ReSharper disable once CppMemberFunctionMayBeConst
+auto logger::backend_end_batch() -> std::chrono::steady_clock::time_point {
+  return impl_->backend_end_batch();
+}
+
+// ReSharper disable once CppMemberFunctionMayBeConst
+auto logger::backend_sync() -> std::chrono::steady_clock::time_point {
+  return impl_->backend_sync();
+}
+
+// ReSharper disable once CppMemberFunctionMayBeConst
+void logger::backend_flush_suppressed() {
+  return impl_->backend_flush_suppressed();
+}
+
+// ReSharper disable once CppMemberFunctionMayBeConst
+void logger::backend_write_through(const message& msg) {
+  return impl_->backend_write_through(msg);
+}
+
+// ReSharper disable once CppMemberFunctionMayBeConst
+void logger::backend_crash_prepare() noexcept {
+  return impl_->backend_crash_prepare();
+}
+
+// ReSharper disable once CppMemberFunctionMayBeConst
+void logger::backend_crash_write(const message& msg,
+                                 const sink::time_point point) noexcept {
+  return impl_->backend_crash_write(msg, point);
+}
+
+}  // namespace jt::log
@@ -1,18 +1,24 @@
 module;
 
 #include <lz4frame.h>
+#include <signal.h>
 
 // module jt:log.service;
 module jt;
 
 import std;
 import :log.message;
+import :log.deferred;
 import :detail.intrusive_mpsc_queue;
 import :detail.string;
 import :detail.vector;
 import :detail.deque;
 import :detail.unordered_map;
 import :detail.cpu_pause;
+import :detail.spsc_ring;
+import :detail.rcu;
+import :detail.eventcount;
+import :detail.tsc_clock;
 
 namespace jt::log {
 
@@ -28,7 +34,8 @@ static constexpr LZ4F_preferences_t lz4_preferences = {
     {0, 0, 0}, /* reserved, must be set to 0 */
 };
 
-constexpr size_t lz4_input_chunk_size = 16ull * 1024;
+// 大文件按块压缩，每块是一个独立的 LZ4 frame
+constexpr size_t lz4_chunk_size = 4ull * 1024 * 1024;
 
 class lz4_exception final : public std::exception {
  public:
@@ -41,11 +48,9 @@ class lz4_exception final : public std::exception {
   size_t ec_;
 };
 
+// 每个压缩线程一个
 struct lz4_data {
   lz4_data() {  // NOLINT(*-pro-type-member-init)
-    input_chunk.resize(lz4_input_chunk_size);
-    output_buff.resize(
-        LZ4F_compressBound(lz4_input_chunk_size, &lz4_preferences));
     if (const size_t ec = LZ4F_createCompressionContext(&ctx, LZ4F_VERSION);
         LZ4F_isError(ec)) {
       throw lz4_exception(ec);  // NOLINT
@@ -54,213 +59,1130 @@ struct lz4_data {
 
   ~lz4_data() noexcept { LZ4F_freeCompressionContext(ctx); }
 
-  void compress(  // NOLINT(*-convert-member-functions-to-static)
-      const detail::string& src, const detail::string& directory) {
-    auto stamp = std::chrono::high_resolution_clock::now();
-    // 转成utf-8指针
-    std::ifstream input;
-    std::u8string_view u8strv(reinterpret_cast<const char8_t*>(src.c_str()),
-                              src.size());
-    std::filesystem::path path_src = u8strv;
-    input.open(path_src, std::ios_base::binary);
-    if (!input.is_open()) {
-      print_stderr("compress open input {} fail\n", src);
-      return;
+  lz4_data(const lz4_data&) = delete;
+  lz4_data(lz4_data&&) = delete;
+  auto operator=(const lz4_data&) -> lz4_data& = delete;
+  auto operator=(lz4_data&&) -> lz4_data& = delete;
+
+  // 把 src 压缩为一个完整的 frame
+  auto compress_frame(const detail::vector<char>& src,
+                      detail::vector<char>& dest) -> bool {
+    dest.resize(LZ4F_HEADER_SIZE_MAX +
+                LZ4F_compressBound(src.size(), &lz4_preferences));
+    const auto header_size = LZ4F_compressBegin(ctx, dest.data(), dest.size(),
+                                                &lz4_preferences);
+    if (LZ4F_isError(header_size)) {
+      print_stderr("Failed to start compression: error 0x{:x}\n", header_size);
+      return false;
     }
 
-    // 转成utf-8指针
-    std::ofstream output;
-    u8strv = {reinterpret_cast<const char8_t*>(directory.c_str()),
-              directory.size()};
-    std::filesystem::path path_dest = u8strv;
-    path_dest /= path_src.filename();
-    path_dest.replace_extension(".log.lz4");
-    output.open(path_dest, std::ios_base::binary | std::ios_base::trunc);
-    if (!output.is_open()) {
-      print_stderr("compress open output {} fail\n", src);
-      return;
+    std::size_t size = header_size;
+    if (!src.empty()) {
+      const auto compressed_size =
+          LZ4F_compressUpdate(ctx, dest.data() + size, dest.size() - size,
+                              src.data(), src.size(), nullptr);
+      if (LZ4F_isError(compressed_size)) {
+        print_stderr("Compression failed: error 0x{:x}\n", compressed_size);
+        return false;
+      }
+      size += compressed_size;
     }
 
-    std::uint64_t count_out = 0;
-    std::uint64_t count_in = 0;
-    if (!compress_file(output, count_out, count_in, input)) {
-      return;
+    const auto end_size =
+        LZ4F_compressEnd(ctx, dest.data() + size, dest.size() - size, nullptr);
+    if (LZ4F_isError(end_size)) {
+      print_stderr("Failed to end compression: error 0x{:x}\n", end_size);
+      return false;
     }
+    dest.resize(size + end_size);
+    return true;
+  }
 
-    if (count_in > 0) {
-      auto cost = std::chrono::duration_cast<std::chrono::milliseconds>(
-                      std::chrono::high_resolution_clock::now() - stamp)
-                      .count();
-      auto rate =
-          static_cast<double>(count_out) / static_cast<double>(count_in);
-      print_stdout("{}: compress {} -> {} bytes, {:.2}, {}ms\n", src, count_in,
-                   count_out, rate, cost);
+  LZ4F_compressionContext_t ctx{nullptr};
+};
+
+// 一个文件中同时压缩的一组数据块，空闲的压缩线程领取其中的块协助压缩，
+// 结果按顺序拼接，多个 frame 连在一起仍是合法的 .lz4 文件
+struct lz4_window {
+  // 领取并压缩数据块，直到没有剩余
+  void work(lz4_data& data) {
+    while (true) {
+      const auto i = next.fetch_add(1, std::memory_order::relaxed);
+      if (i >= count) return;
+
+      const bool ok = data.compress_frame(input[i], output[i]);
+      std::scoped_lock lock{mutex};
+      failed = failed || !ok;
+      if (++done == count) {
+        cv.notify_all();
+      }
     }
+  }
 
-    input.close();
-    if (std::error_code ec; !std::filesystem::remove(path_src, ec)) {
-      print_stderr("after compress remove fail, {}\n",
-                   detail::system_category().message(ec.value()));
+  void wait() {
+    std::unique_lock lock{mutex};
+    cv.wait(lock, [this] { return done == count; });
+  }
+
+  detail::vector<detail::vector<char>> input;
+  detail::vector<detail::vector<char>> output;
+  std::size_t count{0};
+  std::atomic<std::size_t> next{0};
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::size_t done{0};
+  bool failed{false};
+};
+
+// 线程环形缓冲区中的日志记录头，后面紧跟日志内容
+struct ring_record {
+  // ReSharper disable once CppRedundantQualifier
+  message_type type{message_type::log};
+  // logger 的句柄
+  std::uint32_t logger{0};
+  std::uint32_t sid{0};
+  std::chrono::system_clock::time_point point{};
+  std::uint64_t tick{0};
+  const site* where{nullptr};
+};
+
+static_assert(std::is_trivially_copyable_v<ring_record>);
+
+// 生产者：开启 tsc_clock 时只读计数器，由写线程换算
+template <typename T>
+void stamp(const detail::tsc_clock& clock, T& record) noexcept {
+  if (clock.enabled()) {
+    record.tick = detail::tsc_clock::read();
+  } else {
+    record.point = std::chrono::system_clock::now();
+  }
+}
+
+template <typename T>
+auto point_of(const detail::tsc_clock& clock, const T& record) noexcept
+    -> std::chrono::system_clock::time_point {
+  return record.tick == 0 ? record.point : clock.to_time_point(record.tick);
+}
+
+struct thread_ring {
+  explicit thread_ring(const std::size_t capacity)
+      : ring(capacity), tid(detail::tid()) {}
+
+  detail::spsc_ring ring;
+  std::uint64_t tid;
+  std::atomic<bool> closed{false};
+  std::atomic<std::uint64_t> dropped{0};
+  std::atomic<std::uint64_t> overwritten{0};
+};
+
+// 线程退出时把它的环形缓冲区标记为关闭，由写线程读完后回收
+struct thread_ring_holder {
+  ~thread_ring_holder() noexcept {
+    for (const auto& ring : rings | std::views::values) {
+      ring->closed.store(true, std::memory_order::release);
     }
   }
 
-  bool compress_file(std::ofstream& output, std::uint64_t& count_out,
-                     std::uint64_t& count_in, std::ifstream& input) {
-    /* write frame header */
-    auto const header_size = LZ4F_compressBegin(
-        ctx, output_buff.data(), output_buff.size(), &lz4_preferences);
-    if (LZ4F_isError(header_size)) {
-      print_stderr("Failed to start compression: error 0x{:x}\n", header_size);
-      return false;
+  detail::vector<std::pair<std::uint64_t, std::shared_ptr<thread_ring>>> rings;
+};
+
+std::atomic<std::uint64_t> service_id_seed{0};
+
+/**
+ * logger 的句柄表，写线程按消息中的句柄找到 logger，
+ * 不必为每条消息增减 weak_ptr 的引用计数。
+ *
+ * 句柄低 20 位是槽位，高 12 位是槽位的代数，槽位复用后旧句柄失效。
+ * logger 析构时先清空槽位，等所有写线程结束当前一轮之后才回收槽位，
+ * 之后读到旧句柄的消息找不到 logger，直接丢弃。
+ */
+class logger_handles {
+ public:
+  static constexpr std::uint32_t index_bits = 20;
+  static constexpr std::uint32_t index_mask = (1u << index_bits) - 1;
+  // 高 12 位为代数，从 1 开始
+  static constexpr std::uint32_t max_generation =
+      ~std::uint32_t{0} >> index_bits;
+  static constexpr std::uint32_t chunk_size = 256;
+
+  logger_handles() = default;
+
+  ~logger_handles() noexcept {
+    for (auto& chunk : chunks_) {
+      const detail::unique_ptr<slot_chunk> ptr{chunk.load()};
     }
-    output.write(output_buff.data(), static_cast<std::streamsize>(header_size));
-    count_out = header_size;
+  }
 
-    /* stream file */
-    while (!input.eof()) {
-      input.read(input_chunk.data(), lz4_input_chunk_size);
-      const auto read_size = static_cast<size_t>(input.gcount());
-      /* nothing left to read from input file */
-      if (read_size == 0) break;
-      count_in += read_size;
+  logger_handles(const logger_handles&) = delete;
+  logger_handles(logger_handles&&) = delete;
+  auto operator=(const logger_handles&) -> logger_handles& = delete;
+  auto operator=(logger_handles&&) -> logger_handles& = delete;
+
+  // 槽位用完时返回 0，这个 logger 的异步日志都被丢弃
+  auto acquire(logger* lg) -> std::uint32_t {
+    std::scoped_lock lock{mutex_};
+    std::uint32_t index;
+    if (!free_.empty()) {
+      index = free_.back();
+      free_.pop_back();
+    } else if (next_ <= index_mask) {
+      index = next_++;
+      auto& chunk = chunks_[index / chunk_size];
+      if (chunk.load(std::memory_order::relaxed) == nullptr) {
+        chunk.store(detail::make_unique<slot_chunk>().release(),
+                    std::memory_order::release);
+      }
+    } else {
+      return 0;
+    }
 
-      auto const compressed_size =
-          LZ4F_compressUpdate(ctx, output_buff.data(), output_buff.size(),
-                              input_chunk.data(), read_size, nullptr);
-      if (LZ4F_isError(compressed_size)) {
-        print_stderr("Compression failed: error 0x{:x}\n", compressed_size);
-        return false;
+    auto& s = slot_of(index);
+    const auto generation =
+        (s.handle.load(std::memory_order::relaxed) >> index_bits) + 1;
+    const auto handle = generation << index_bits | index;
+    // 先写句柄再发布指针，find 读到新指针时一定读到新句柄
+    s.handle.store(handle, std::memory_order::relaxed);
+    s.ptr.store(lg, std::memory_order::release);
+    return handle;
+  }
+
+  // 之后 find 找不到这个句柄，但写线程可能还在使用之前取得的指针
+  void clear(const std::uint32_t handle) noexcept {
+    slot_of(handle & index_mask).ptr.store(nullptr,
+                                           std::memory_order::seq_cst);
+  }
+
+  // 在写线程的一轮处理之中调用，这期间 logger 不会析构
+  template <typename F>
+  void for_each(F&& f) const {
+    for (const auto& chunk : chunks_) {
+      const auto* ptr = chunk.load(std::memory_order::acquire);
+      if (ptr == nullptr) return;
+
+      for (const auto& s : ptr->slots) {
+        if (auto* lg = s.ptr.load(std::memory_order::seq_cst)) f(*lg);
       }
-      output.write(output_buff.data(),
-                   static_cast<std::streamsize>(compressed_size));
-      count_out += compressed_size;
     }
+  }
+
+  // 写线程都已经结束使用之后才能复用槽位；
+  // 代数用完的槽位不再复用，否则新句柄会与很久以前的句柄相同
+  void recycle(const std::uint32_t handle) {
+    if (handle >> index_bits == max_generation) return;
+
+    std::scoped_lock lock{mutex_};
+    free_.push_back(handle & index_mask);
+  }
+
+  [[nodiscard]] auto find(const std::uint32_t handle) const noexcept
+      -> logger* {
+    const auto index = handle & index_mask;
+    if (index == 0) return nullptr;
+
+    const auto* chunk =
+        chunks_[index / chunk_size].load(std::memory_order::acquire);
+    if (chunk == nullptr) return nullptr;
+
+    const auto& s = chunk->slots[index % chunk_size];
+    auto* ptr = s.ptr.load(std::memory_order::seq_cst);
+    if (ptr == nullptr ||
+        s.handle.load(std::memory_order::relaxed) != handle) {
+      return nullptr;
+    }
+    return ptr;
+  }
+
+ private:
+  struct slot {
+    std::atomic<logger*> ptr{nullptr};
+    std::atomic<std::uint32_t> handle{0};
+  };
+
+  struct slot_chunk {
+    std::array<slot, chunk_size> slots{};
+  };
+
+  auto slot_of(const std::uint32_t index) const noexcept -> slot& {
+    return chunks_[index / chunk_size]
+        .load(std::memory_order::acquire)
+        ->slots[index % chunk_size];
+  }
+
+  std::array<std::atomic<slot_chunk*>, (index_mask + 1) / chunk_size>
+      chunks_{};
+  std::mutex mutex_;
+  detail::vector<std::uint32_t> free_;
+  // 槽位 0 保留，句柄 0 表示没有 logger
+  std::uint32_t next_{1};
+};
+
+// 一个写线程及其队列
+// 每个 logger 固定由一个 shard 处理，保证同一个 logger 的日志顺序
+class writer_shard {
+ public:
+  writer_shard(const service_config& config,
+               std::atomic<std::ptrdiff_t>& submission_counter,
+               const logger_handles& handles, detail::tsc_clock& clock,
+               const std::atomic<std::uint32_t>& shard_count,
+               const std::uint32_t index)
+      : config_(config),
+        submission_counter_(submission_counter),
+        handles_(handles),
+        clock_(clock),
+        shard_count_(shard_count),
+        index_(index) {}
+
+  ~writer_shard() noexcept {
+    while (message* msg = queue_.pop_front()) {
+      message_allocator_.destroy(msg);
+      message_allocator_.deallocate(msg, 1);
+    }
+    while (message* msg = priority_queue_.pop_front()) {
+      message_allocator_.destroy(msg);
+      message_allocator_.deallocate(msg, 1);
+    }
+  }
+
+  writer_shard(const writer_shard&) = delete;
+  writer_shard(writer_shard&&) = delete;
+  auto operator=(const writer_shard&) -> writer_shard& = delete;
+  auto operator=(writer_shard&&) -> writer_shard& = delete;
+
+  void start() {
+    if (thread_.joinable()) return;
+
+    if (config_.wakeup == wakeup_policy::latency_first) {
+      wakeup_.set_spin(4096, 1u << 17);
+    } else {
+      wakeup_.set_spin(0, 256);
+    }
+
+    thread_ = std::thread{[this]() { return run(); }};
+  }
+
+  // 等刚启动的写线程处理完启动前已经入队的日志
+  void wait_first_round() const {
+    while (round_.load(std::memory_order::acquire) < 2) {
+      std::this_thread::yield();
+    }
+  }
+
+  // 等写线程结束正在进行的一轮，之后它不会再使用已清空句柄的 logger
+  void wait_quiescent() const {
+    // 写线程自己析构 logger 时不需要等待
+    if (std::this_thread::get_id() == thread_.get_id()) return;
+
+    const auto round = round_.load(std::memory_order::seq_cst);
+    if (round % 2 == 0) return;
+
+    while (round_.load(std::memory_order::seq_cst) == round) {
+      std::this_thread::yield();
+    }
+  }
+
+  void stop() {
+    stop_requested_.store(true, std::memory_order::release);
+    wakeup_.notify();
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+  }
+
+  void add_stats(service_stats& result) {
+    std::scoped_lock lock{rings_mutex_};
+    result.ring_dropped += retired_stats_.ring_dropped;
+    result.ring_overwritten += retired_stats_.ring_overwritten;
+    for (const auto& ring : rings_) {
+      result.ring_dropped += ring->dropped.load(std::memory_order::relaxed);
+      result.ring_overwritten +=
+          ring->overwritten.load(std::memory_order::relaxed);
+    }
+  }
+
+  // 调用方负责 submission_counter_ 的计数
+  void push(message* msg) {
+    if (queue_.push_back(msg)) {
+      notify();
+    }
+  }
 
-    /* flush whatever remains within internal buffers */
-    auto const compressed_size =
-        LZ4F_compressEnd(ctx, output_buff.data(), output_buff.size(), nullptr);
-    if (LZ4F_isError(compressed_size)) {
-      print_stderr("Failed to end compression: error 0x{:x}\n",
-                   compressed_size);
+  // 优先通道，调用方负责 submission_counter_ 的计数
+  void push_priority(message* msg) {
+    // 先计数再入队，写线程看到计数时消息可能还没链接上，下一轮会再处理
+    priority_pending_.fetch_add(1, std::memory_order::release);
+    if (priority_queue_.push_back(msg)) {
+      notify();
+    }
+  }
+
+  // 崩溃时在信号处理函数中调用，写线程可能还在运行，只读不改队列。
+  // 线程环形缓冲区和写线程已经取出的日志不处理
+  void crash_drain() const noexcept {
+    const auto drain = [this](const message& msg) {
+      if (msg.type == message_type::flush) return;
+      if (auto* ptr = handles_.find(msg.logger)) {
+        ptr->backend_crash_write(msg, point_of(clock_, msg));
+      }
+    };
+    priority_queue_.visit_unsafe(drain);
+    queue_.visit_unsafe(drain);
+  }
+
+  // 写入当前线程的环形缓冲区，返回 false 表示需要走 push
+  auto push_ring(const std::uint32_t handle, const message_type type,
+                 const std::uint32_t sid, const site* where,
+                 const detail::buffer_1k& buf) -> bool {
+    auto* ring = local_ring();
+    const auto size = sizeof(ring_record) + buf.readable();
+    if (size > ring->ring.max_record_size()) {
+      // 放不进环形缓冲区的日志改走队列，先等本线程之前的记录都被取走，
+      // 队列中的这条一定在它们之后写出
+      std::uint32_t spin = 0;
+      while (!ring->ring.empty() &&
+             submission_counter_.load(std::memory_order::relaxed) >= 0) {
+        if (++spin < 64) {
+          detail::cpu_pause();
+        } else {
+          std::this_thread::yield();
+        }
+      }
       return false;
     }
-    output.write(output_buff.data(),
-                 static_cast<std::streamsize>(compressed_size));
-    count_out += compressed_size;
 
+    std::ptrdiff_t n =
+        submission_counter_.fetch_add(1, std::memory_order::relaxed);
+    if (n < 0) {
+      submission_counter_.compare_exchange_strong(n, thread_closed,
+                                                  std::memory_order::relaxed);
+      return true;
+    }
+
+    ring_record record;
+    record.type = type;
+    record.logger = handle;
+    record.sid = sid;
+    stamp(clock_, record);
+    record.where = where;
+
+    void* data;
+    std::uint32_t spin = 0;
+    while ((data = ring->ring.prepare(size)) == nullptr) {
+      if (config_.overflow == overflow_policy::drop_newest) {
+        ring->dropped.fetch_add(1, std::memory_order::relaxed);
+        submission_counter_.fetch_sub(1, std::memory_order::relaxed);
+        return true;
+      }
+
+      if (config_.overflow == overflow_policy::overwrite_oldest) {
+        if (ring->ring.drop_front()) {
+          ring->overwritten.fetch_add(1, std::memory_order::relaxed);
+        }
+      } else if (++spin < 64) {
+        detail::cpu_pause();
+      } else {
+        std::this_thread::yield();
+      }
+    }
+
+    detail::spsc_ring::write_bytes(data, &record, sizeof(record));
+    detail::spsc_ring::write_bytes(
+        static_cast<std::uint8_t*>(data) + sizeof(record), buf.begin_read(),
+        buf.readable());
+    if (ring->ring.commit()) {
+      notify();
+    }
+    submission_counter_.fetch_sub(1, std::memory_order::relaxed);
     return true;
   }
 
-  detail::vector<char> input_chunk;
-  detail::vector<char> output_buff;
-  LZ4F_compressionContext_t ctx{nullptr};
+ private:
+  // 写线程没有休眠时不进入内核
+  void notify() {
+    ready_.store(true, std::memory_order::release);
+    wakeup_.notify();
+  }
+
+  auto local_ring() -> thread_ring* {
+    thread_local thread_ring_holder holder;
+    for (const auto& [id, ring] : holder.rings) {
+      if (id == id_) return ring.get();
+    }
+
+    // 顺便清理已经销毁的 shard 留下的缓冲区
+    std::erase_if(holder.rings, [](const auto& pair) {
+      return pair.second.use_count() == 1;
+    });
+
+    auto ring = std::allocate_shared<thread_ring>(
+        detail::allocator<thread_ring>{}, config_.ring_capacity);
+    {
+      std::scoped_lock lock{rings_mutex_};
+      rings_.emplace_back(ring);
+      rings_version_.fetch_add(1, std::memory_order::release);
+    }
+    holder.rings.emplace_back(id_, ring);
+    return ring.get();
+  }
+
+  void writer_do_ring(thread_ring& ring) {
+    while (true) {
+      const auto data = ring.ring.front();
+      if (data.empty()) break;
+
+      ring_record record;
+      if (data.size() < sizeof(record)) {
+        ring.ring.pop();
+        continue;
+      }
+
+      // 先拷贝出来，pop 成功才说明数据没有被生产者覆盖
+      detail::spsc_ring::read_bytes(&record, data.data(), sizeof(record));
+      auto& msg = batch_message();
+      auto& buf =
+          record.type == message_type::deferred ? batch_args() : msg.buf;
+      const auto text_size = data.size() - sizeof(record);
+      buf.clear();
+      buf.make_sure_writable(text_size);
+      detail::spsc_ring::read_bytes(buf.begin(), data.data() + sizeof(record),
+                                    text_size);
+      buf.written(text_size);
+      if (!ring.ring.pop()) continue;
+
+      auto* ptr = handles_.find(record.logger);
+      if (ptr == nullptr) continue;
+
+      if (record.type == message_type::flush) {
+        batch_flush(ptr, nullptr);
+        continue;
+      }
+
+      msg.args = nullptr;
+      if (record.type == message_type::deferred) {
+        msg.buf.clear();
+        format_deferred(buf, msg.buf);
+        msg.args = &buf;
+        ++batch_args_used_;
+      }
+      msg.type = message_type::log;
+      msg.lv = record.where->lv;
+      msg.sid = record.sid;
+      msg.tid = ring.tid;
+      msg.point = point_of(clock_, record);
+      msg.where = record.where;
+      ++batch_messages_used_;
+      batch_add(ptr, msg);
+    }
+  }
+
+  void writer_do_rings() {
+    if (const auto version = rings_version_.load(std::memory_order::acquire);
+        version != writer_rings_version_) {
+      std::scoped_lock lock{rings_mutex_};
+      writer_rings_ = rings_;
+      writer_rings_version_ = version;
+    }
+
+    bool retired = false;
+    for (const auto& ring : writer_rings_) {
+      writer_do_priority();
+      // 先确认关闭再读取，保证读到线程退出前写入的全部日志
+      const bool closed = ring->closed.load(std::memory_order::acquire);
+      writer_do_ring(*ring);
+      retired = retired || (closed && ring->ring.empty());
+    }
+
+    if (!retired) return;
+
+    std::scoped_lock lock{rings_mutex_};
+    std::erase_if(rings_, [this](const std::shared_ptr<thread_ring>& ring) {
+      if (!ring->closed.load(std::memory_order::acquire) ||
+          !ring->ring.empty()) {
+        return false;
+      }
+
+      retired_stats_.ring_dropped +=
+          ring->dropped.load(std::memory_order::relaxed);
+      retired_stats_.ring_overwritten +=
+          ring->overwritten.load(std::memory_order::relaxed);
+      return true;
+    });
+    rings_version_.fetch_add(1, std::memory_order::release);
+  }
+
+  // 写线程：把延迟格式化的参数展开为日志内容
+  void expand_deferred(message& msg) {
+    auto& args = batch_args();
+    ++batch_args_used_;
+    args.clear();
+    args.append(msg.buf.begin_read(), msg.buf.readable());
+    msg.buf.clear();
+    format_deferred(args, msg.buf);
+    msg.type = message_type::log;
+    msg.args = &args;
+  }
+
+  // 写线程：把生产者记录的计数器换算为时间
+  void resolve_point(message& msg) const noexcept {
+    if (msg.tick == 0) return;
+
+    msg.point = clock_.to_time_point(msg.tick);
+    msg.tick = 0;
+  }
+
+  // 优先通道：先交出已收集的普通日志，再写出全部优先日志并 flush
+  void writer_do_priority() {
+    if (priority_pending_.load(std::memory_order::acquire) == 0) return;
+
+    batch_dispatch();
+    std::size_t count = 0;
+    while (message* msg = priority_queue_.pop_front()) {
+      ++count;
+      auto* ptr = handles_.find(msg->logger);
+      if (ptr == nullptr) {
+        message_allocator_.destroy(msg);
+        message_allocator_.deallocate(msg, 1);
+        continue;
+      }
+
+      if (msg->type == message_type::deferred) {
+        expand_deferred(*msg);
+      }
+      resolve_point(*msg);
+      batch_owned_.push_back(msg);
+      batch_add(ptr, *msg);
+      if (!std::ranges::contains(priority_loggers_, ptr)) {
+        priority_loggers_.push_back(ptr);
+      }
+    }
+    priority_pending_.fetch_sub(count, std::memory_order::relaxed);
+
+    batch_dispatch();
+    for (auto* ptr : priority_loggers_) {
+      ptr->backend_flush();
+    }
+    priority_loggers_.clear();
+  }
+
+  // 一轮处理期间 round_ 为奇数，见 wait_quiescent
+  inline void writer_do_message() {
+    round_.fetch_add(1, std::memory_order::seq_cst);
+    writer_do_priority();
+    // ReSharper disable once CppDFAUnreachableCode
+    // ReSharper disable once CppDFAEndlessLoop
+    while (message* msg = queue_.pop_front()) {
+      writer_do_priority();
+      auto* ptr = handles_.find(msg->logger);
+      if (ptr != nullptr && msg->type != message_type::flush) {
+        if (msg->type == message_type::deferred) {
+          expand_deferred(*msg);
+        }
+        resolve_point(*msg);
+        batch_owned_.push_back(msg);
+        batch_add(ptr, *msg);
+        continue;
+      }
+
+      if (ptr != nullptr) {
+        batch_flush(ptr, msg);
+      }
+      message_allocator_.destroy(msg);
+      message_allocator_.deallocate(msg, 1);
+    }
+
+    writer_do_rings();
+    batch_end();
+    round_.fetch_add(1, std::memory_order::release);
+  }
+
+  // 写线程：按 logger 分组收集日志，同一个 logger 的日志保持原有顺序
+  void batch_add(logger* ptr, const message& msg) {
+    auto it = std::ranges::find(batches_, ptr, &writer_batch::logger);
+    if (it == batches_.end()) {
+      it = batches_.insert(batches_.end(), writer_batch{ptr, {}});
+    }
+    it->messages.push_back(&msg);
+
+    // flush 等到 batch_end，那时环形缓冲区中之前的日志也已写出
+    if (++batch_size_ >= max_batch_size) batch_dispatch();
+  }
+
+  // 把收集到的日志按 logger 一次交给 sink，然后回收本批的消息
+  void batch_dispatch() {
+    for (auto& batch : batches_) {
+      if (batch.messages.empty()) continue;
+
+      batch.logger->backend_log_batch(batch.messages);
+      batch.messages.clear();
+    }
+
+    for (message* msg : batch_owned_) {
+      message_allocator_.destroy(msg);
+      message_allocator_.deallocate(msg, 1);
+    }
+    batch_owned_.clear();
+    batch_size_ = 0;
+    batch_messages_used_ = 0;
+    batch_args_used_ = 0;
+  }
+
+  // flush 推迟到本轮结束，同一个 logger 的多个 flush 只执行一次，
+  // 开启 fsync 的 sink 因此只落盘一次
+  void batch_flush(logger* ptr, message* msg) {
+    if (!std::ranges::contains(flush_loggers_, ptr)) {
+      flush_loggers_.push_back(ptr);
+    }
+    if (msg != nullptr && msg->done) {
+      flush_waiters_.push_back(std::move(msg->done));
+    }
+  }
+
+  // 一轮处理结束，让 sink 写出缓存，再完成本轮的 flush
+  void batch_end() {
+    batch_dispatch();
+    for (const auto& batch : batches_) {
+      const auto next = batch.logger->backend_end_batch();
+      if (next == std::chrono::steady_clock::time_point::max()) continue;
+
+      // 还有等待定时落盘的数据，之后没有新日志时由 sync_dirty 落盘
+      next_sync_ = (std::min)(next_sync_, next);
+      if (const auto handle = batch.logger->handle();
+          !std::ranges::contains(unsynced_, handle)) {
+        unsynced_.push_back(handle);
+      }
+    }
+    batches_.clear();
+    complete_flushes();
+  }
+
+  void complete_flushes() {
+    for (auto* ptr : flush_loggers_) {
+      ptr->backend_flush();
+    }
+    flush_loggers_.clear();
+    for (const auto& done : flush_waiters_) {
+      done->set_value();
+    }
+    flush_waiters_.clear();
+  }
+
+  // 环形缓冲区中的日志需要拷贝到消息里，消息在 batch_dispatch 后复用
+  auto batch_message() -> message& {
+    if (batch_messages_used_ == batch_messages_.size()) {
+      batch_messages_.emplace_back();
+    }
+    return batch_messages_[batch_messages_used_];
+  }
+
+  auto batch_args() -> detail::buffer_1k& {
+    if (batch_args_used_ == batch_args_.size()) {
+      batch_args_.emplace_back();
+    }
+    return batch_args_[batch_args_used_];
+  }
+
+  // 每秒一次，输出本 shard 的 logger 限速后还没有报告的丢弃条数
+  void sweep_suppressed() {
+    const auto now = std::chrono::steady_clock::now();
+    if (now - last_sweep_ < std::chrono::seconds(1)) return;
+    last_sweep_ = now;
+
+    const auto count = shard_count_.load(std::memory_order::acquire);
+    round_.fetch_add(1, std::memory_order::seq_cst);
+    handles_.for_each([&](logger& lg) {
+      if (lg.shard_key() % count != index_) return;
+
+      try {
+        lg.backend_flush_suppressed();
+      } catch (...) {
+      }
+    });
+    round_.fetch_add(1, std::memory_order::seq_cst);
+  }
+
+  // 按 fsync_policy::interval 落盘写过日志的 logger，
+  // 保证没有新日志时数据也在间隔内落盘；logger 只按句柄记录
+  void sync_dirty() {
+    if (unsynced_.empty() ||
+        std::chrono::steady_clock::now() < next_sync_) {
+      return;
+    }
+
+    next_sync_ = std::chrono::steady_clock::time_point::max();
+    round_.fetch_add(1, std::memory_order::seq_cst);
+    std::erase_if(unsynced_, [&](const std::uint32_t handle) {
+      auto* ptr = handles_.find(handle);
+      if (ptr == nullptr) return true;
+
+      try {
+        const auto next = ptr->backend_sync();
+        if (next == std::chrono::steady_clock::time_point::max()) return true;
+
+        next_sync_ = (std::min)(next_sync_, next);
+        return false;
+      } catch (...) {
+        return true;
+      }
+    });
+    round_.fetch_add(1, std::memory_order::seq_cst);
+  }
+
+  // 最多等待 2 秒，有 logger 等待落盘时提前醒来
+  [[nodiscard]] auto wait_timeout() const noexcept
+      -> std::chrono::milliseconds {
+    constexpr std::chrono::milliseconds max_timeout{2000};
+    if (unsynced_.empty()) return max_timeout;
+
+    const auto now = std::chrono::steady_clock::now();
+    if (next_sync_ <= now) return std::chrono::milliseconds{0};
+    if (next_sync_ - now >= max_timeout) return max_timeout;
+    return std::chrono::ceil<std::chrono::milliseconds>(next_sync_ - now);
+  }
+
+  void run() {
+    while (true) {
+      clock_.recalibrate();
+      writer_do_message();
+      sweep_suppressed();
+      sync_dirty();
+
+      // 先登记等待再检查，之后的 notify 不会丢失
+      const auto key = wakeup_.prepare_wait();
+      if (ready_.load(std::memory_order::acquire) ||
+          stop_requested_.load(std::memory_order::acquire)) {
+        wakeup_.cancel_wait();
+      } else {
+        wakeup_.wait_for(key, wait_timeout());
+      }
+      const bool stop_requested =
+          stop_requested_.load(std::memory_order::acquire);
+      // 读取到 true 时与生产者同步，下一轮一定能读到它提交的日志
+      ready_.exchange(false, std::memory_order::acq_rel);
+
+      // service 已经关闭了提交计数，这里读完剩余的日志即可
+      if (stop_requested) {
+        writer_do_message();
+        break;
+      }
+    }
+  }
+
+  const service_config& config_;
+  std::atomic<std::ptrdiff_t>& submission_counter_;
+  const logger_handles& handles_;
+  detail::tsc_clock& clock_;
+  const std::atomic<std::uint32_t>& shard_count_;
+  const std::uint32_t index_;
+  std::chrono::steady_clock::time_point last_sweep_{};
+  // 写过日志、可能还有数据等待定时落盘的 logger 句柄
+  detail::vector<std::uint32_t> unsynced_{};
+  std::chrono::steady_clock::time_point next_sync_{};
+  std::atomic<std::uint64_t> round_{0};
+  const std::uint64_t id_{service_id_seed.fetch_add(1) + 1};
+
+  std::thread thread_{};
+  detail::eventcount wakeup_{};
+  detail::intrusive_mpsc_queue<&message::next> queue_{};
+  detail::intrusive_mpsc_queue<&message::next> priority_queue_{};
+  std::atomic<std::size_t> priority_pending_{0};
+  detail::vector<logger*> priority_loggers_{};
+  std::atomic<bool> ready_{false};
+  std::atomic<bool> stop_requested_{false};
+  detail::allocator<message> message_allocator_{};
+
+  // 每线程环形缓冲区
+  std::mutex rings_mutex_{};
+  detail::vector<std::shared_ptr<thread_ring>> rings_{};
+  std::atomic<std::uint32_t> rings_version_{0};
+  service_stats retired_stats_{};
+  detail::vector<std::shared_ptr<thread_ring>> writer_rings_{};
+  std::uint32_t writer_rings_version_{0};
+
+  // 批量处理
+  struct writer_batch {
+    log::logger* logger;
+    detail::vector<const message*> messages;
+  };
+  static constexpr std::size_t max_batch_size = 256;
+  detail::vector<writer_batch> batches_{};
+  std::size_t batch_size_{0};
+  detail::vector<message*> batch_owned_{};
+  detail::deque<message> batch_messages_{};
+  std::size_t batch_messages_used_{0};
+  detail::deque<detail::buffer_1k> batch_args_{};
+  std::size_t batch_args_used_{0};
+  detail::vector<logger*> flush_loggers_{};
+  detail::vector<detail::unique_ptr<std::promise<void>>> flush_waiters_{};
 };
 
+class service_impl;
+
+void install_crash_handler(service_impl* impl);
+
+void remove_crash_handler(const service_impl* impl);
+
 class service_impl {
  public:
   using logger_sptr = std::shared_ptr<logger>;
-  using logger_wptr = std::weak_ptr<logger>;
 
-  ~service_impl() { stop(); }
+  static constexpr std::uint32_t max_writer_threads = 64;
+  static constexpr std::uint32_t max_lz4_threads = 64;
+
+  service_impl() {  // NOLINT
+    // start 之前写入的日志先由第一个 shard 保存
+    shards_[0] = detail::make_unique<writer_shard>(
+        config_, writer_submission_counter_, handles_, clock_, shard_count_,
+        0);
+  }
+
+  ~service_impl() {
+    stop();
+    // 写线程都已停止，登记的 logger 在 shard 销毁之前析构
+    clear();
+    // 其他地方还持有的 logger 比 service 活得久，
+    // 解除它们的句柄，之后析构时不再访问 service
+    handles_.for_each([](logger& lg) { lg.set_handle(0); });
+  }
 
   void register_logger(logger_sptr& ptr) {  // NOLINT
+    ptr->set_shard_key(logger_seed_.fetch_add(1, std::memory_order::relaxed));
+    ptr->set_handle(handles_.acquire(ptr.get()));
     const auto name = ptr->get_name();
     std::scoped_lock lock{loggers_mutex_};
-    if (const auto it = loggers_.find(name); it != loggers_.end()) {
-      loggers_.erase(it);
-    }
-    loggers_.emplace(name, ptr);
+    loggers_.update([&](logger_table& table) {
+      if (const auto it = table.loggers.find(name);
+          it != table.loggers.end()) {
+        table.loggers.erase(it);
+      }
+      table.loggers.emplace(name, ptr);
+    });
   }
 
   logger_sptr find(const std::string_view name) {  // NOLINT
-    std::scoped_lock lock{loggers_mutex_};
-    if (const auto it = loggers_.find(name); it == loggers_.end()) {
-      return {};
-    } else {
-      return it->second;
-    }
+    return loggers_.read([name](const logger_table& table) -> logger_sptr {
+      if (const auto it = table.loggers.find(name);
+          it == table.loggers.end()) {
+        return {};
+      } else {
+        return it->second;
+      }
+    });
   }
 
   void erase(const std::string_view name) {  // NOLINT
     std::scoped_lock lock{loggers_mutex_};
-    loggers_.erase(name);
+    loggers_.update(
+        [name](logger_table& table) { table.loggers.erase(name); });
   }
 
   void clear() {  // NOLINT(*-convert-member-functions-to-static)
-    {
-      std::scoped_lock lock{loggers_mutex_};
-      loggers_.clear();
-    }
-    set_default({});
+    std::scoped_lock lock{loggers_mutex_};
+    loggers_.update([](logger_table& table) {
+      table.loggers.clear();
+      table.default_logger.reset();
+    });
   }
 
-  void start() {  // NOLINT(*-convert-member-functions-to-static)
-    if (writer_thread_.joinable() || lz4_thread_.joinable()) return;
+  void start(const service_config& config) {
+    if (started_) return;
+
+    started_ = true;
+    // 生产者读到 ring_enabled_ 之后才读取 config_，由下面的 release 发布
+    config_ = config;
+    if (config_.tsc_clock) clock_.enable();
+    const auto count = std::clamp(config_.writer_threads, std::uint32_t{1},
+                                  max_writer_threads);
+    for (std::uint32_t i = 1; i < count; ++i) {
+      shards_[i] = detail::make_unique<writer_shard>(
+          config_, writer_submission_counter_, handles_, clock_, shard_count_,
+          i);
+    }
+    shard_count_.store(count, std::memory_order::release);
+    ring_enabled_.store(config_.thread_ring, std::memory_order::release);
+    priority_write_through_.store(config_.priority_write_through,
+                                  std::memory_order::relaxed);
+    priority_level_.store(config_.priority_level, std::memory_order::release);
+
+    // start 之前的日志都在 shard 0 中。等按旧数量选择 shard 的生产者
+    // 提交完，再等 shard 0 写完一轮，之后才启动其他 shard，
+    // 同一个 logger 新的日志不会先于旧的写出
+    routing_.synchronize();
+    shards_[0]->start();
+    if (count > 1) shards_[0]->wait_first_round();
+    for (std::uint32_t i = 1; i < count; ++i) {
+      shards_[i]->start();
+    }
 
-    writer_thread_ = std::thread{[this]() { return writer_run(); }};
+    const auto lz4_count =
+        std::clamp(config_.lz4_threads, std::uint32_t{1}, max_lz4_threads);
+    for (std::uint32_t i = 0; i < lz4_count; ++i) {
+      lz4_data_.emplace_back(detail::make_unique<lz4_data>());
+    }
+    for (const auto& data : lz4_data_) {
+      lz4_threads_.emplace_back([this, &data]() { return lz4_run(*data); });
+    }
 
-    lz4_thread_ = std::thread{[this]() { return lz4_run(); }};
+    if (config_.crash_handler) install_crash_handler(this);
   }
 
   void stop() {
-    {
-      std::scoped_lock lock{writer_mutex_};
-      writer_stop_requested_ = true;
-      writer_cv_.notify_one();
+    remove_crash_handler(this);
+
+    // 关闭提交计数，等待正在提交的生产者完成，之后的提交全部丢弃。
+    // 写线程还在运行，阻塞在环形缓冲区上的生产者可以继续写入
+    std::ptrdiff_t expected = 0;
+    while (!writer_submission_counter_.compare_exchange_weak(
+        expected, thread_closed, std::memory_order::relaxed)) {
+      if (expected < 0) break;
+
+      std::this_thread::yield();
+      expected = 0;
     }
-    if (writer_thread_.joinable()) {
-      writer_thread_.join();
+
+    const auto count = shard_count_.load(std::memory_order::acquire);
+    for (std::uint32_t i = 0; i < count; ++i) {
+      shards_[i]->stop();
     }
 
     {
       std::scoped_lock lock{lz4_mutex_};
       lz4_stop_requested_ = true;
-      lz4_cv_.notify_one();
+      lz4_cv_.notify_all();
     }
-    if (lz4_thread_.joinable()) {
-      lz4_thread_.join();
+    for (auto& thread : lz4_threads_) {
+      if (thread.joinable()) {
+        thread.join();
+      }
     }
   }
 
+  // 崩溃时在信号处理函数中调用，取不到锁时跳过 sink 的缓存
+  void crash_drain() noexcept {
+    loggers_.read([](const logger_table& table) {
+      for (const auto& ptr : table.loggers | std::views::values) {
+        ptr->backend_crash_prepare();
+      }
+    });
+
+    const auto count = shard_count_.load(std::memory_order::acquire);
+    for (std::uint32_t i = 0; i < count; ++i) {
+      shards_[i]->crash_drain();
+    }
+  }
+
+  void release_handle(const std::uint32_t handle) noexcept {
+    handles_.clear(handle);
+    const auto count = shard_count_.load(std::memory_order::acquire);
+    for (std::uint32_t i = 0; i < count; ++i) {
+      shards_[i]->wait_quiescent();
+    }
+    try {
+      handles_.recycle(handle);
+    } catch (...) {
+    }
+  }
+
+  auto stats() -> service_stats {
+    service_stats result;
+    const auto count = shard_count_.load(std::memory_order::acquire);
+    for (std::uint32_t i = 0; i < count; ++i) {
+      shards_[i]->add_stats(result);
+    }
+    return result;
+  }
+
   auto get_default() -> logger_sptr {  // NOLINT
-#if defined(__clang__)
-    std::scoped_lock lock{loggers_mutex_};
-    return default_logger_;
-#else
-    return default_logger_.load(std::memory_order::relaxed);
-#endif
+    return loggers_.read(
+        [](const logger_table& table) { return table.default_logger; });
   }
 
   void set_default(const logger_sptr& ptr) {  // NOLINT
-#if defined(__clang__)
     std::scoped_lock lock{loggers_mutex_};
-    default_logger_ = ptr;
-#else
-    default_logger_.store(ptr, std::memory_order::relaxed);
-#endif
+    loggers_.update(
+        [&ptr](logger_table& table) { table.default_logger = ptr; });
   }
 
-  void flush(const logger_wptr& ptr) {
+  void flush(logger& lg) {
+    const auto routing = routing_.enter();
+    auto& shard = shard_of(lg);
+    if (ring_enabled_.load(std::memory_order::acquire)) {
+      const detail::buffer_1k empty;
+      if (shard.push_ring(lg.handle(), message_type::flush, 0,
+                          nullptr, empty)) {
+        return;
+      }
+    }
+
     message* msg = message_allocator_.allocate(1);
     message_allocator_.construct(msg);
-    msg->logger = ptr;
+    msg->logger = lg.handle();
     msg->type = message_type::flush;
-    return push_log_message(msg);
+    return push_log_message(shard, msg);
   }
 
-  void log(const logger_wptr& ptr, const std::uint32_t sid, const level lv,
-           detail::buffer_1k& buf, const std::source_location& source) {
+  // 线程环形缓冲区中本线程之前的日志在同一轮中读出，不需要走环形缓冲区
+  auto flush_and_wait(logger& lg) -> std::future<void> {
     message* msg = message_allocator_.allocate(1);
     message_allocator_.construct(msg);
-    msg->logger = ptr;
-    msg->type = message_type::log;
+    msg->logger = lg.handle();
+    msg->type = message_type::flush;
+    msg->done = detail::make_unique<std::promise<void>>();
+    auto future = msg->done->get_future();
+    const auto routing = routing_.enter();
+    push_log_message(shard_of(lg), msg);
+    return future;
+  }
+
+  void log(logger& lg, const std::uint32_t sid, const site& where,
+           detail::buffer_1k& buf, const bool deferred) {
+    const auto routing = routing_.enter();
+    if (is_priority(where.lv)) {
+      return log_priority(lg, sid, where, buf, deferred);
+    }
+
+    auto& shard = shard_of(lg);
+    const auto type = deferred ? message_type::deferred : message_type::log;
+    if (ring_enabled_.load(std::memory_order::acquire) &&
+        shard.push_ring(lg.handle(), type, sid, &where, buf)) {
+      return;
+    }
+
+    message* msg = message_allocator_.allocate(1);
+    message_allocator_.construct(msg);
+    msg->logger = lg.handle();
+    msg->type = type;
     msg->buf = std::move(buf);
-    msg->source = source;
-    msg->lv = lv;
+    msg->where = &where;
+    msg->lv = where.lv;
     msg->sid = sid;
-    msg->point = std::chrono::system_clock::now();
+    stamp(clock_, *msg);
     msg->tid = detail::tid();
-    return push_log_message(msg);
+    return push_log_message(shard, msg);
+  }
+
+  void log_backtrace(logger& lg, message& saved, const level trigger) {
+    const auto routing = routing_.enter();
+    const bool priority = is_priority(trigger);
+    if (priority && priority_write_through_.load(std::memory_order::relaxed)) {
+      if (saved.type == message_type::deferred) {
+        detail::buffer_1k text;
+        format_deferred(saved.buf, text);
+        saved.buf = std::move(text);
+        saved.type = message_type::log;
+      }
+      return lg.backend_write_through(saved);
+    }
+
+    message* msg = message_allocator_.allocate(1);
+    message_allocator_.construct(msg);
+    msg->logger = lg.handle();
+    msg->type = saved.type;
+    msg->buf = std::move(saved.buf);
+    msg->where = saved.where;
+    msg->lv = saved.lv;
+    msg->sid = saved.sid;
+    msg->point = saved.point;
+    msg->tid = saved.tid;
+    return push_log_message(shard_of(lg), msg, priority);
   }
 
   void post_lz4(const std::filesystem::path& file_name,  // NOLINT
@@ -294,7 +1216,50 @@ class service_impl {
     lz4_queue_.emplace_back(std::move(msg));
     lz4_cv_.notify_one();
   }
-  void push_log_message(message* msg) {
+
+  [[nodiscard]] auto is_priority(const level lv) const noexcept -> bool {
+    const auto priority = priority_level_.load(std::memory_order::relaxed);
+    return lv != level::off &&
+           static_cast<std::uint8_t>(lv) <= static_cast<std::uint8_t>(priority);
+  }
+
+  void log_priority(logger& lg, const std::uint32_t sid, const site& where,
+                    detail::buffer_1k& buf, const bool deferred) {
+    if (priority_write_through_.load(std::memory_order::relaxed)) {
+      message msg;
+      if (deferred) {
+        format_deferred(buf, msg.buf);
+      } else {
+        msg.buf = std::move(buf);
+      }
+      msg.where = &where;
+      msg.lv = where.lv;
+      msg.sid = sid;
+      msg.point = std::chrono::system_clock::now();
+      msg.tid = detail::tid();
+      return lg.backend_write_through(msg);
+    }
+
+    message* msg = message_allocator_.allocate(1);
+    message_allocator_.construct(msg);
+    msg->logger = lg.handle();
+    msg->type = deferred ? message_type::deferred : message_type::log;
+    msg->buf = std::move(buf);
+    msg->where = &where;
+    msg->lv = where.lv;
+    msg->sid = sid;
+    stamp(clock_, *msg);
+    msg->tid = detail::tid();
+    return push_log_message(shard_of(lg), msg, true);
+  }
+
+  auto shard_of(const logger& lg) -> writer_shard& {
+    const auto count = shard_count_.load(std::memory_order::acquire);
+    return *shards_[lg.shard_key() % count];
+  }
+
+  void push_log_message(writer_shard& shard, message* msg,
+                        const bool priority = false) {
     std::ptrdiff_t n =
         writer_submission_counter_.fetch_add(1, std::memory_order::relaxed);
     if (n < 0) {
@@ -305,58 +1270,14 @@ class service_impl {
       return;
     }
 
-    if (writer_queue_.push_back(msg)) {
-      std::scoped_lock lock{writer_mutex_};
-      writer_ready_ = true;
-      writer_cv_.notify_one();
+    if (priority) {
+      shard.push_priority(msg);
+    } else {
+      shard.push(msg);
     }
     writer_submission_counter_.fetch_sub(1, std::memory_order::relaxed);
   }
 
-  inline void writer_do_message() {
-    // ReSharper disable once CppDFAUnreachableCode
-    // ReSharper disable once CppDFAEndlessLoop
-    while (message* msg = writer_queue_.pop_front()) {
-      // ReSharper disable once CppDFAEndlessLoop
-      if (const auto ptr = msg->logger.lock()) {
-        if (msg->type == message_type::log) {
-          ptr->backend_log(*msg);
-        } else {
-          ptr->backend_flush();
-        }
-      }
-
-      message_allocator_.destroy(msg);
-      message_allocator_.deallocate(msg, 1);
-    }
-  }
-
-  void writer_run() {
-    while (true) {
-      writer_do_message();
-
-      std::unique_lock lock{writer_mutex_};
-      writer_cv_.wait_for(lock, std::chrono::seconds(2), [this] {
-        return writer_ready_ || writer_stop_requested_;
-      });
-      const bool stop_requested = writer_stop_requested_;
-      writer_ready_ = false;
-      lock.unlock();
-
-      if (stop_requested) {
-        std::ptrdiff_t expected = 0;
-        while (!writer_submission_counter_.compare_exchange_weak(
-            expected, thread_closed, std::memory_order::relaxed)) {
-          detail::cpu_pause();
-          expected = 0;
-        }
-
-        writer_do_message();
-        break;
-      }
-    }
-  }
-
   void clear_lz4_files(const lz4_message& msg) {  // NOLINT
     if (msg.keep_days == 0) return;
 
@@ -407,7 +1328,7 @@ class service_impl {
         continue;
       }
 
-      if (!strv.starts_with(msg.file_name) || !strv.ends_with(".log.lz4")) {
+      if (!strv.starts_with(msg.file_name) || !strv.ends_with(".lz4")) {
         continue;
       }
 
@@ -436,65 +1357,266 @@ class service_impl {
     }
   }
 
-  void lz4_run() {  // NOLINT(*-make-member-function-const)
+  // 空闲的压缩线程协助压缩 window 中的数据块
+  void post_lz4_help(const std::shared_ptr<lz4_window>& window,
+                     const std::size_t count) {
+    if (count == 0) return;
+
+    std::scoped_lock lock{lz4_mutex_};
+    for (std::size_t i = 0; i < count; ++i) {
+      lz4_message msg;
+      msg.tp = lz4_message::type::help;
+      msg.window = window;
+      lz4_queue_.emplace_front(std::move(msg));
+    }
+    lz4_cv_.notify_all();
+  }
+
+  void compress_lz4(lz4_data& data, const lz4_message& msg) {
+    const auto stamp = std::chrono::steady_clock::now();
+    const auto& src = msg.file_name;
+    // 转成utf-8指针
+    std::ifstream input;
+    std::u8string_view u8strv(reinterpret_cast<const char8_t*>(src.c_str()),
+                              src.size());
+    std::filesystem::path path_src = u8strv;
+    input.open(path_src, std::ios_base::binary);
+    if (!input.is_open()) {
+      print_stderr("compress open input {} fail\n", src);
+      return;
+    }
+
+    // 转成utf-8指针
+    std::ofstream output;
+    u8strv = {reinterpret_cast<const char8_t*>(msg.lz4_directory.c_str()),
+              msg.lz4_directory.size()};
+    std::filesystem::path path_dest = u8strv;
+    path_dest /= path_src.filename();
+    path_dest += ".lz4";
+    output.open(path_dest, std::ios_base::binary | std::ios_base::trunc);
+    if (!output.is_open()) {
+      print_stderr("compress open output {} fail\n", src);
+      return;
+    }
+
+    const auto width = lz4_data_.size();
+    auto window =
+        std::allocate_shared<lz4_window>(detail::allocator<lz4_window>{});
+    window->input.resize(width);
+    window->output.resize(width);
+    std::uint64_t count_in = 0;
+    std::uint64_t count_out = 0;
     while (true) {
-      detail::deque<lz4_message> queue;
-      bool stop_requested = false;
+      while (window->count < width) {
+        auto& chunk = window->input[window->count];
+        chunk.resize(lz4_chunk_size);
+        input.read(chunk.data(), lz4_chunk_size);
+        chunk.resize(static_cast<std::size_t>(input.gcount()));
+        // 空文件也要写一个 frame
+        if (chunk.empty() && (count_in > 0 || window->count > 0)) break;
+
+        count_in += chunk.size();
+        ++window->count;
+        if (chunk.empty()) break;
+      }
+      if (window->count == 0) break;
+
+      post_lz4_help(window, window->count - 1);
+      window->work(data);
+      window->wait();
+      if (window->failed) {
+        print_stderr("compress {} fail\n", src);
+        return;
+      }
+
+      for (std::size_t i = 0; i < window->count; ++i) {
+        const auto& frame = window->output[i];
+        output.write(frame.data(), static_cast<std::streamsize>(frame.size()));
+        count_out += frame.size();
+      }
+
+      // 迟到的协助线程可能还持有旧的 window，缓冲区转移到新的 window
+      if (count_in == 0 || !input) break;
+      auto next =
+          std::allocate_shared<lz4_window>(detail::allocator<lz4_window>{});
+      next->input = std::move(window->input);
+      next->output = std::move(window->output);
+      window = std::move(next);
+    }
+
+    if (!output) {
+      print_stderr("compress write output {} fail\n", src);
+      return;
+    }
+
+    if (count_in > 0) {
+      const auto cost = std::chrono::duration_cast<std::chrono::microseconds>(
+                            std::chrono::steady_clock::now() - stamp)
+                            .count();
+      const auto seconds =
+          static_cast<double>((std::max)(cost, decltype(cost){1})) / 1e6;
+      const auto rate =
+          static_cast<double>(count_out) / static_cast<double>(count_in);
+      constexpr double mb = 1024.0 * 1024.0;
+      print_stdout(
+          "{}: compress {} -> {} bytes, {:.2}, {}ms, in {:.1}MB/s, "
+          "out {:.1}MB/s\n",
+          src, count_in, count_out, rate, cost / 1000,
+          static_cast<double>(count_in) / mb / seconds,
+          static_cast<double>(count_out) / mb / seconds);
+    }
+
+    input.close();
+    if (std::error_code ec; !std::filesystem::remove(path_src, ec)) {
+      print_stderr("after compress remove fail, {}\n",
+                   detail::system_category().message(ec.value()));
+    }
+  }
+
+  void lz4_run(lz4_data& data) {
+    while (true) {
+      lz4_message msg;
       {
         std::unique_lock lock{lz4_mutex_};
         lz4_cv_.wait_for(lock, std::chrono::seconds(2), [this] {
-          return !lz4_queue_.empty() || writer_stop_requested_;
+          return !lz4_queue_.empty() || lz4_stop_requested_;
         });
-        queue = std::move(lz4_queue_);
-        stop_requested = writer_stop_requested_;
-      }
-
-      for (auto& msg : queue) {
-        if (msg.tp == lz4_message::type::lz4) {
-          lz4_data_.compress(msg.file_name, msg.lz4_directory);
-        } else if (msg.tp == lz4_message::type::clear) {
-          clear_lz4_files(msg);
+        if (lz4_queue_.empty()) {
+          if (lz4_stop_requested_) break;
+          continue;
         }
+
+        msg = std::move(lz4_queue_.front());
+        lz4_queue_.pop_front();
       }
 
-      if (stop_requested) break;
+      if (msg.tp == lz4_message::type::lz4) {
+        compress_lz4(data, msg);
+      } else if (msg.tp == lz4_message::type::help) {
+        msg.window->work(data);
+      } else if (msg.tp == lz4_message::type::clear) {
+        clear_lz4_files(msg);
+      }
     }
   }
 
   struct lz4_message {  // NOLINT(*-pro-type-member-init)
-    enum class type { lz4, clear };
+    enum class type { lz4, clear, help };
     type tp{type::lz4};
     detail::string lz4_directory;
     detail::string file_name;
     std::uint32_t keep_days{0};
+    std::shared_ptr<lz4_window> window;
   };
 
+  logger_handles handles_{};
+  detail::tsc_clock clock_{};
+
+  // 查找和取默认 logger 不加锁，修改时复制整张表，
+  // loggers_mutex_ 只串行化修改
+  struct logger_table {
+    detail::unordered_map<std::string_view, logger_sptr> loggers;
+    logger_sptr default_logger;
+  };
   std::mutex loggers_mutex_{};
-  detail::unordered_map<std::string_view, logger_sptr> loggers_{};
-#if defined(__clang__)
-  logger_sptr default_logger_{};
-#else
-  std::atomic<logger_sptr> default_logger_{};
-#endif
+  detail::rcu_cell<logger_table> loggers_{};
 
-  std::thread writer_thread_{};
-  std::mutex writer_mutex_{};
-  std::condition_variable writer_cv_{};
-  detail::intrusive_mpsc_queue<&message::next> writer_queue_{};
+  std::atomic<std::uint32_t> logger_seed_{0};
 
-  std::thread lz4_thread_{};
+  detail::vector<std::thread> lz4_threads_{};
+  detail::vector<detail::unique_ptr<lz4_data>> lz4_data_{};
   detail::deque<lz4_message> lz4_queue_{};
   std::mutex lz4_mutex_{};
   std::condition_variable_any lz4_cv_{};
-  lz4_data lz4_data_;
 
   bool lz4_stop_requested_{false};
-  bool writer_ready_{false};
-  bool writer_stop_requested_{false};
+  bool started_{false};
   std::atomic<std::ptrdiff_t> writer_submission_counter_{0};
   detail::allocator<message> message_allocator_{};
+  service_config config_{};
+  std::atomic<bool> ring_enabled_{false};
+  std::atomic<level> priority_level_{level::off};
+  std::atomic<bool> priority_write_through_{false};
+  std::array<detail::unique_ptr<writer_shard>, max_writer_threads> shards_{};
+  std::atomic<std::uint32_t> shard_count_{1};
+  // 生产者选择 shard 并提交期间持有，start 据此等待读到旧数量的生产者
+  detail::rcu_domain routing_{};
+};
+
+constexpr int crash_signals[] = {SIGSEGV, SIGABRT, SIGFPE, SIGILL,
+#if !defined(_WIN32)
+                                 SIGBUS
+#endif
 };
 
+constexpr std::size_t max_crash_services = 16;
+
+std::array<std::atomic<service_impl*>, max_crash_services> crash_services{};
+std::atomic_flag crash_draining{};
+std::once_flag crash_handler_once{};
+
+#if defined(_WIN32)
+std::array<void (*)(int), std::size(crash_signals)> crash_previous{};
+#else
+std::array<struct sigaction, std::size(crash_signals)> crash_previous{};
+#endif
+
+void crash_signal_handler(const int sig) {
+  // 只处理第一次进入，写出时再次崩溃直接交给原来的处理
+  if (!crash_draining.test_and_set()) {
+    for (auto& impl : crash_services) {
+      if (auto* ptr = impl.load(std::memory_order::acquire)) {
+        ptr->crash_drain();
+      }
+    }
+  }
+
+  for (std::size_t i = 0; i < std::size(crash_signals); ++i) {
+    if (crash_signals[i] != sig) continue;
+#if defined(_WIN32)
+    ::signal(sig, crash_previous[i]);
+#else
+    ::sigaction(sig, &crash_previous[i], nullptr);
+#endif
+  }
+  // 信号在处理函数返回后重新递送给原来的处理
+  ::raise(sig);
+}
+
+void install_crash_handler(service_impl* impl) {
+  std::call_once(crash_handler_once, [] {
+    for (std::size_t i = 0; i < std::size(crash_signals); ++i) {
+#if defined(_WIN32)
+      crash_previous[i] = ::signal(crash_signals[i], &crash_signal_handler);
+#else
+      struct sigaction action {};
+      action.sa_handler = &crash_signal_handler;
+      ::sigemptyset(&action.sa_mask);
+      action.sa_flags = SA_RESTART;
+      ::sigaction(crash_signals[i], &action, &crash_previous[i]);
+#endif
+    }
+  });
+
+  for (auto& slot : crash_services) {
+    service_impl* expected = nullptr;
+    if (slot.compare_exchange_strong(expected, impl,
+                                     std::memory_order::acq_rel)) {
+      return;
+    }
+  }
+}
+
+void remove_crash_handler(const service_impl* impl) {
+  for (auto& slot : crash_services) {
+    auto* expected = const_cast<service_impl*>(impl);
+    if (slot.compare_exchange_strong(expected, nullptr,
+                                     std::memory_order::acq_rel)) {
+      return;
+    }
+  }
+}
+
 service::service() : impl_(detail::make_unique<service_impl>()) {}  // NOLINT
 
 service::~service() noexcept = default;
@@ -511,11 +1633,16 @@ void service::erase(const std::string_view name) { return impl_->erase(name); }
 void service::clear() { return impl_->clear(); }
 
 // ReSharper disable once CppMemberFunctionMayBeConst
-void service::start() { return impl_->start(); }
+void service::start(const service_config& config) {
+  return impl_->start(config);
+}
 
 // ReSharper disable once CppMemberFunctionMayBeConst
 void service::stop() { return impl_->stop(); }
 
+// ReSharper disable once CppMemberFunctionMayBeConst
+auto service::stats() -> service_stats { return impl_->stats(); }
+
 // ReSharper disable once CppMemberFunctionMayBeConst
 auto service::get_default() -> logger_sptr { return impl_->get_default(); }
 
@@ -525,13 +1652,22 @@ void service::set_default(const logger_sptr& ptr) {
 }
 
 // ReSharper disable once CppMemberFunctionMayBeConst
-void service::flush(const logger_wptr& ptr) { return impl_->flush(ptr); }
+void service::flush(logger& lg) { return impl_->flush(lg); }
+
+// ReSharper disable once CppMemberFunctionMayBeConst
+auto service::flush_and_wait(logger& lg) -> std::future<void> {
+  return impl_->flush_and_wait(lg);
+}
+
+// ReSharper disable once CppMemberFunctionMayBeConst
+void service::log(logger& lg, const std::uint32_t sid, const site& where,
+                  detail::buffer_1k& buf, const bool deferred) {
+  return impl_->log(lg, sid, where, buf, deferred);
+}
 
 // ReSharper disable once CppMemberFunctionMayBeConst
-void service::log(const logger_wptr& ptr, const std::uint32_t sid,
-                  const level lv, detail::buffer_1k& buf,
-                  const std::source_location& source) {
-  return impl_->log(std::move(ptr), sid, lv, buf, source);
+void service::log_backtrace(logger& lg, message& msg, const level trigger) {
+  return impl_->log_backtrace(lg, msg, trigger);
 }
 
 auto service::create_logger(const std::string_view& name,  // NOLINT
@@ -543,6 +1679,11 @@ auto service::create_logger(const std::string_view& name,  // NOLINT
   return ptr;
 }
 
+// ReSharper disable once CppMemberFunctionMayBeConst
+void service::release_handle(const std::uint32_t handle) noexcept {
+  return impl_->release_handle(handle);
+}
+
 // ReSharper disable once CppMemberFunctionMayBeConst
 void service::post_lz4(const std::filesystem::path& file_name,
                        const std::string_view lz4_directory) {
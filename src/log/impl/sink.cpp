@@ -3,6 +3,7 @@ module jt;
 
 import std;
 import :detail.cache_line;
+import :detail.rcu;
 import :log.message;
 import :log.default_formatter;
 
@@ -11,7 +12,8 @@ namespace jt::log {
 class sink_impl {
  public:
   sink_impl() {  // NOLINT
-    formatter_ = detail::make_dynamic_unique<formatter, default_formatter>();
+    set_formatter(
+        detail::make_dynamic_unique<formatter, default_formatter>());
   }
 
   void set_level(const level lv) { lv_.store(lv, std::memory_order::relaxed); }
@@ -24,27 +26,156 @@ class sink_impl {
 
     detail::buffer_1k buf;
     std::size_t color_start, color_stop;
+    // 同步 logger 的多个调用线程在锁外同时格式化，只有写入排队
+    if (format_concurrent(msg, buf, color_start, color_stop)) {
+      std::lock_guard lock(mtx_);
+      return s->write(msg.lv, msg.point, buf, color_start, color_stop);
+    }
+
     std::lock_guard lock(mtx_);
-    formatter_->format(msg, buf, color_start, color_stop);
+    formatter_.load(std::memory_order::relaxed)
+        ->format(msg, buf, color_start, color_stop);
     return s->write(msg.lv, msg.point, buf, color_start, color_stop);
   }
 
+  void log_batch(const std::span<const message* const> msgs, sink* s) {
+    const auto lv = lv_.load(std::memory_order::relaxed);
+    std::lock_guard lock(mtx_);
+    auto* current = formatter_.load(std::memory_order::relaxed);
+    batch_buf_.clear();
+    batch_lines_.clear();
+    for (const message* msg : msgs) {
+      if (static_cast<std::uint8_t>(msg->lv) > static_cast<std::uint8_t>(lv)) {
+        continue;
+      }
+
+      sink::batch_line line{msg->lv, msg->point, batch_buf_.readable()};
+      current->format(*msg, batch_buf_, line.color_start, line.color_stop);
+      line.stop = batch_buf_.readable();
+      batch_lines_.push_back(line);
+    }
+
+    if (batch_lines_.empty()) return;
+
+    return s->write_batch(batch_lines_, batch_buf_);
+  }
+
+  [[nodiscard]] auto should_log(const level lv) const noexcept -> bool {
+    return static_cast<std::uint8_t>(lv) <=
+           static_cast<std::uint8_t>(lv_.load(std::memory_order::relaxed));
+  }
+
+  [[nodiscard]] auto share_key() const noexcept -> const void* {
+    const auto reader = readers_.enter();
+    const auto* current = formatter_.load(std::memory_order::acquire);
+    return current->is_concurrent() ? current->share_key() : nullptr;
+  }
+
+  // 信号处理函数中调用，不能进入 readers_，只读取一次指针
+  [[nodiscard]] auto is_plain_text() const noexcept -> bool {
+    return formatter_.load(std::memory_order::acquire)->is_plain_text();
+  }
+
+  void format(const message& msg, detail::buffer_1k& buf,  // NOLINT
+              std::size_t& color_start, std::size_t& color_stop) const {
+    const auto reader = readers_.enter();
+    return formatter_.load(std::memory_order::acquire)
+        ->format(msg, buf, color_start, color_stop);
+  }
+
+  void log_formatted(const level lv, const sink::time_point& point,  // NOLINT
+                     const detail::buffer_1k& buf,
+                     const std::size_t color_start,
+                     const std::size_t color_stop, sink* s) {
+    if (!should_log(lv)) return;
+
+    std::lock_guard lock(mtx_);
+    return s->write(lv, point, buf, color_start, color_stop);
+  }
+
+  void log_batch_formatted(const std::span<const sink::batch_line> lines,
+                           const detail::buffer_1k& buf, sink* s) {
+    const auto lv = lv_.load(std::memory_order::relaxed);
+    const auto passed = [lv](const sink::batch_line& line) {
+      return static_cast<std::uint8_t>(line.lv) <=
+             static_cast<std::uint8_t>(lv);
+    };
+
+    std::lock_guard lock(mtx_);
+    if (std::ranges::all_of(lines, passed)) {
+      return s->write_batch(lines, buf);
+    }
+
+    // write_batch 要求各行连续，过滤后重新拼接
+    batch_buf_.clear();
+    batch_lines_.clear();
+    for (const auto& line : lines) {
+      if (!passed(line)) continue;
+
+      const auto start = batch_buf_.readable();
+      batch_buf_.append(buf.begin_read() + line.start, line.stop - line.start);
+      batch_lines_.push_back({line.lv, line.point, start,
+                              batch_buf_.readable(),
+                              start + (line.color_start - line.start),
+                              start + (line.color_stop - line.start)});
+    }
+
+    if (batch_lines_.empty()) return;
+
+    return s->write_batch(batch_lines_, batch_buf_);
+  }
+
   void flush(sink* s) {  // NOLINT(*-convert-member-functions-to-static)
     std::lock_guard lock(mtx_);
     return s->flush_unlock();
   }
 
-  void set_formatter(sink::formatter_ptr ptr) {
+  auto end_batch(sink* s)  // NOLINT(*-convert-member-functions-to-static)
+      -> std::chrono::steady_clock::time_point {
     std::lock_guard lock(mtx_);
-    formatter_ = std::move(ptr);
+    return s->end_batch_unlock();
+  }
+
+  auto sync(sink* s)  // NOLINT(*-convert-member-functions-to-static)
+      -> std::chrono::steady_clock::time_point {
+    std::lock_guard lock(mtx_);
+    return s->sync_unlock();
+  }
+
+  // 其他线程可能还在锁外使用旧的 formatter，等它们离开后再释放
+  void set_formatter(sink::formatter_ptr ptr) {
+    sink::formatter_ptr old;
+    {
+      std::lock_guard lock(mtx_);
+      formatter_.store(ptr.get(), std::memory_order::release);
+      old = std::exchange(owner_, std::move(ptr));
+    }
+    readers_.synchronize();
   }
 
  private:
+  // formatter 可以并发使用时在锁外格式化，否则返回 false
+  auto format_concurrent(const message& msg, detail::buffer_1k& buf,
+                         std::size_t& color_start,
+                         std::size_t& color_stop) const -> bool {
+    const auto reader = readers_.enter();
+    auto* current = formatter_.load(std::memory_order::acquire);
+    if (!current->is_concurrent()) return false;
+
+    current->format(msg, buf, color_start, color_stop);
+    return true;
+  }
+
   std::atomic<level> lv_{level::trace};
   char padding[detail::cache_line_bytes - sizeof(std::atomic<level>)];
 
-  sink::formatter_ptr formatter_;
+  std::atomic<formatter*> formatter_{nullptr};
+  sink::formatter_ptr owner_;
+  // 锁外使用 formatter 的读者
+  detail::rcu_domain readers_;
   std::mutex mtx_;
+  detail::buffer_1k batch_buf_;
+  detail::vector<sink::batch_line> batch_lines_;
 };
 
 sink::sink() { impl_ = detail::make_unique<sink_impl>(); }  // NOLINT
@@ -56,11 +187,64 @@ void sink::set_level(const level lv) { return impl_->set_level(lv); }
 
 void sink::log(const message& msg) { return impl_->log(msg, this); }
 
+void sink::log_batch(const std::span<const message* const> msgs) {
+  return impl_->log_batch(msgs, this);
+}
+
+void sink::write_batch(const std::span<const batch_line> lines,
+                       const detail::buffer_1k& buf) {
+  detail::buffer_1k temp;
+  for (const auto& line : lines) {
+    temp.clear();
+    temp.append(buf.begin_read() + line.start, line.stop - line.start);
+    write(line.lv, line.point, temp, line.color_start - line.start,
+          line.color_stop - line.start);
+  }
+}
+
 void sink::flush() { return impl_->flush(this); }
 
+auto sink::end_batch() -> std::chrono::steady_clock::time_point {
+  return impl_->end_batch(this);
+}
+
+auto sink::sync() -> std::chrono::steady_clock::time_point {
+  return impl_->sync(this);
+}
+
 // ReSharper disable once CppMemberFunctionMayBeConst
 void sink::set_formatter(formatter_ptr ptr) {
   return impl_->set_formatter(std::move(ptr));
 }
 
+auto sink::should_log(const level lv) const noexcept -> bool {
+  return impl_->should_log(lv);
+}
+
+auto sink::share_key() const noexcept -> const void* {
+  return impl_->share_key();
+}
+
+auto sink::is_plain_text() const noexcept -> bool {
+  return impl_->is_plain_text();
+}
+
+// ReSharper disable once CppMemberFunctionMayBeConst
+void sink::format(const message& msg, detail::buffer_1k& buf,
+                  std::size_t& color_start, std::size_t& color_stop) {
+  return impl_->format(msg, buf, color_start, color_stop);
+}
+
+void sink::log_formatted(const level lv, const time_point& point,
+                         const detail::buffer_1k& buf,
+                         const std::size_t color_start,
+                         const std::size_t color_stop) {
+  return impl_->log_formatted(lv, point, buf, color_start, color_stop, this);
+}
+
+void sink::log_batch_formatted(const std::span<const batch_line> lines,
+                               const detail::buffer_1k& buf) {
+  return impl_->log_batch_formatted(lines, buf, this);
+}
+
 }  // namespace jt::log
\ No newline at end of file
@@ -0,0 +1,551 @@
+// module jt:log.sink.binary;
+module jt;
+
+import std;
+import :detail.unordered_map;
+import :detail.vector;
+import :detail.string;
+import :log.message;
+import :log.deferred;
+import :log.default_formatter;
+
+namespace jt::log {
+
+/**
+ * 文件格式（整数均为 LEB128 变长编码，有符号数先做 zigzag）
+ * @code
+ * 文件头  'J' 'T' 'L' 'B' version base_ns
+ * 日志点  0x01 id level line file fmt signature
+ * 文本    0x02 delta_ns tid sid id text
+ * 参数    0x03 delta_ns tid sid id args
+ * @endcode
+ * 字符串为长度加内容。文件头会重置时间基准和日志点字典，
+ * 之后紧跟当前已知的全部日志点。参数记录的 args 是 :log.deferred 的参数编码，
+ * 由日志点的 signature 描述各参数的类型。
+ * delta_ns 是与同一文件中上一条记录的时间差，在写入时计算，
+ * 文件头之后的第一条记录以 base_ns 为基准。
+ */
+constexpr std::string_view binary_magic = "JTLB";
+constexpr std::uint8_t binary_version = 1;
+constexpr std::uint8_t tag_site = 0x01;
+constexpr std::uint8_t tag_text = 0x02;
+constexpr std::uint8_t tag_args = 0x03;
+
+void put_varint(detail::buffer_1k& buf, std::uint64_t value) {
+  std::uint8_t bytes[10];
+  std::size_t size = 0;
+  while (value >= 0x80) {
+    bytes[size++] = static_cast<std::uint8_t>(value | 0x80);
+    value >>= 7;
+  }
+  bytes[size++] = static_cast<std::uint8_t>(value);
+  buf.append(bytes, size);
+}
+
+void put_bytes(detail::buffer_1k& buf, const std::string_view strv) {
+  put_varint(buf, strv.size());
+  buf.append(strv);
+}
+
+constexpr auto zigzag(const std::int64_t value) noexcept -> std::uint64_t {
+  return (static_cast<std::uint64_t>(value) << 1) ^
+         static_cast<std::uint64_t>(value >> 63);
+}
+
+constexpr auto unzigzag(const std::uint64_t value) noexcept -> std::int64_t {
+  return static_cast<std::int64_t>(value >> 1) ^
+         -static_cast<std::int64_t>(value & 1);
+}
+
+struct site_key {
+  const char* file{nullptr};
+  std::uint_least32_t line{0};
+  level lv{level::off};
+  const char* fmt{nullptr};
+  const char* signature{nullptr};
+
+  auto operator==(const site_key&) const -> bool = default;
+};
+
+struct site_key_hash {
+  auto operator()(const site_key& key) const noexcept -> std::size_t {
+    std::size_t seed = std::hash<const void*>{}(key.file);
+    const auto combine = [&seed](const std::size_t value) {
+      seed ^= value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2);
+    };
+    combine(key.line);
+    combine(static_cast<std::size_t>(key.lv));
+    combine(std::hash<const void*>{}(key.fmt));
+    return seed;
+  }
+};
+
+class sink_binary_imp {
+ public:
+  // 不写时间差，tag 为记录类型所在的位置，写入时在它后面插入时间差
+  void encode(const message& msg, detail::buffer_1k& buf, std::size_t& tag) {
+    deferred_header header{};
+    bool packed = false;
+    if (msg.args != nullptr && msg.args->readable() >= sizeof(header)) {
+      std::memcpy(&header, msg.args->begin_read(), sizeof(header));
+      packed = std::string_view(header.signature).find('?') ==
+               std::string_view::npos;
+    }
+
+    const site_key key{msg.where->file_path.data(), msg.where->line, msg.lv,
+                       packed ? header.fmt : nullptr,
+                       packed ? header.signature : nullptr};
+    const auto [it, inserted] = sites_.try_emplace(
+        key, static_cast<std::uint32_t>(sites_.size()));
+    if (inserted) {
+      const auto begin = buf.readable();
+      buf.push_back(tag_site);
+      put_varint(buf, it->second);
+      buf.push_back(static_cast<std::uint8_t>(key.lv));
+      put_varint(buf, key.line);
+      put_bytes(buf, key.file);
+      put_bytes(buf, packed ? std::string_view(header.fmt, header.fmt_size)
+                            : std::string_view{});
+      put_bytes(buf, packed ? std::string_view(header.signature)
+                            : std::string_view{});
+      dictionary_.append(buf.begin_read() + begin, buf.readable() - begin);
+    }
+
+    tag = buf.readable();
+    buf.push_back(packed ? tag_args : tag_text);
+    put_varint(buf, msg.tid);
+    put_varint(buf, msg.sid);
+    put_varint(buf, it->second);
+    if (packed) {
+      put_bytes(buf, {reinterpret_cast<const char*>(msg.args->begin_read()) +
+                          sizeof(header),
+                      msg.args->readable() - sizeof(header)});
+    } else {
+      put_bytes(buf, static_cast<std::string_view>(msg.buf));
+    }
+  }
+
+  // 新文件的开头：文件头加上全部日志点，以 ns 为时间基准
+  void encode_header(detail::buffer_1k& buf, const std::int64_t ns) {
+    buf.append(binary_magic);
+    buf.push_back(binary_version);
+    put_varint(buf, zigzag(ns));
+    buf.append(dictionary_.begin_read(), dictionary_.readable());
+    last_ns_ = ns;
+  }
+
+  void encode_delta(detail::buffer_1k& buf, const std::int64_t ns) {
+    put_varint(buf, zigzag(ns - last_ns_));
+    last_ns_ = ns;
+  }
+
+  std::uint64_t file_sequence{0};
+  // 有记录没能写入时为 false，它可能带有日志点定义，下一条记录前重写文件头
+  bool synced{false};
+  detail::buffer_1k scratch;
+
+ private:
+  detail::unordered_map<site_key, std::uint32_t, site_key_hash> sites_{};
+  detail::buffer_4k dictionary_{};
+  // 当前文件中最后写入的记录的时间
+  std::int64_t last_ns_{0};
+};
+
+class binary_formatter final : public formatter {
+ public:
+  explicit binary_formatter(sink_binary_imp& imp) : imp_(imp) {}
+
+  void format(const message& msg, detail::buffer_1k& buf,
+              std::size_t& color_start, std::size_t& color_stop) override {
+    // color_start 借用来传递记录类型的位置，见 sink_binary::write_record
+    color_stop = 0;
+    return imp_.encode(msg, buf, color_start);
+  }
+
+ private:
+  sink_binary_imp& imp_;
+};
+
+sink_binary::sink_binary(service& s, const sink_file_config& config)  // NOLINT
+    : sink_file(s, config, sink_file_storage{.extension = ".jtlog"}),
+      binary_(detail::make_unique<sink_binary_imp>()) {
+  set_formatter(
+      detail::make_dynamic_unique<formatter, binary_formatter>(*binary_));
+}
+
+sink_binary::~sink_binary() noexcept = default;
+
+void sink_binary::write(level, const time_point& point,
+                        const detail::buffer_1k& buf,
+                        const std::size_t color_start, std::size_t) {
+  return write_record(point, buf.begin_read(), buf.readable(), color_start);
+}
+
+void sink_binary::write_batch(const std::span<const batch_line> lines,
+                              const detail::buffer_1k& buf) {
+  for (const auto& line : lines) {
+    write_record(line.point, buf.begin_read() + line.start,
+                 line.stop - line.start, line.color_start - line.start);
+  }
+}
+
+void sink_binary::write_record(const time_point& point,
+                               const std::uint8_t* data,
+                               const std::size_t size, const std::size_t tag) {
+  if (tag >= size) return;
+
+  if (!prepare(point)) {
+    binary_->synced = false;
+    return;
+  }
+
+  using namespace std::chrono;
+  const auto ns = duration_cast<nanoseconds>(point.time_since_epoch()).count();
+  auto& out = binary_->scratch;
+  out.clear();
+  std::size_t skip = 0;
+  if (const auto seq = file_sequence();
+      !binary_->synced || seq != binary_->file_sequence) {
+    binary_->file_sequence = seq;
+    binary_->synced = true;
+    binary_->encode_header(out, ns);
+    // 文件头已经包含全部日志点，不再重复这条记录前面的定义
+    skip = tag;
+  }
+
+  out.append(data + skip, tag + 1 - skip);
+  binary_->encode_delta(out, ns);
+  out.append(data + tag + 1, size - tag - 1);
+  return append(out.begin_read(), out.readable());
+}
+
+auto sink_binary::crash_prepare() noexcept -> int {
+  sink_file::crash_prepare();
+  return -1;
+}
+
+class binary_reader {
+ public:
+  static constexpr std::uint64_t max_bytes = 64ull * 1024 * 1024;
+
+  explicit binary_reader(std::istream& input) : buf_(*input.rdbuf()) {}
+
+  auto read_u8(std::uint8_t& value) -> bool {
+    const auto ch = buf_.sbumpc();
+    if (ch == std::char_traits<char>::eof()) return false;
+    value = static_cast<std::uint8_t>(ch);
+    return true;
+  }
+
+  auto read_varint(std::uint64_t& value) -> bool {
+    value = 0;
+    for (std::uint32_t shift = 0; shift < 64; shift += 7) {
+      std::uint8_t byte;
+      if (!read_u8(byte)) return false;
+      value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+      if ((byte & 0x80) == 0) return true;
+    }
+    return false;
+  }
+
+  auto read_bytes(detail::string& value) -> bool {
+    std::uint64_t size;
+    if (!read_varint(size) || size > max_bytes) return false;
+    value.resize(size);
+    return buf_.sgetn(value.data(), static_cast<std::streamsize>(size)) ==
+           static_cast<std::streamsize>(size);
+  }
+
+ private:
+  std::streambuf& buf_;
+};
+
+using packed_value =
+    std::variant<bool, char, std::int64_t, std::uint64_t, float, double,
+                 long double, const void*, std::nullptr_t, std::string_view>;
+
+template <typename T>
+auto unpack(std::string_view& data, packed_value& value) -> bool {
+  T temp;
+  if (data.size() < sizeof(temp)) return false;
+  std::memcpy(&temp, data.data(), sizeof(temp));
+  data.remove_prefix(sizeof(temp));
+  if constexpr (std::is_integral_v<T> && !std::same_as<T, bool> &&
+                !std::same_as<T, char>) {
+    if constexpr (std::is_signed_v<T>) {
+      value = static_cast<std::int64_t>(temp);
+    } else {
+      value = static_cast<std::uint64_t>(temp);
+    }
+  } else {
+    value = temp;
+  }
+  return true;
+}
+
+auto unpack_args(const std::string_view signature, std::string_view data,
+                 detail::vector<packed_value>& values) -> bool {
+  values.clear();
+  for (const char code : signature) {
+    auto& value = values.emplace_back();
+    bool ok;
+    switch (code) {
+      case 'b':
+        ok = unpack<bool>(data, value);
+        break;
+      case 'c':
+        ok = unpack<char>(data, value);
+        break;
+      case 'a':
+        ok = unpack<std::int8_t>(data, value);
+        break;
+      case 'h':
+        ok = unpack<std::int16_t>(data, value);
+        break;
+      case 'i':
+        ok = unpack<std::int32_t>(data, value);
+        break;
+      case 'l':
+        ok = unpack<std::int64_t>(data, value);
+        break;
+      case 'A':
+        ok = unpack<std::uint8_t>(data, value);
+        break;
+      case 'H':
+        ok = unpack<std::uint16_t>(data, value);
+        break;
+      case 'I':
+        ok = unpack<std::uint32_t>(data, value);
+        break;
+      case 'L':
+        ok = unpack<std::uint64_t>(data, value);
+        break;
+      case 'f':
+        ok = unpack<float>(data, value);
+        break;
+      case 'd':
+        ok = unpack<double>(data, value);
+        break;
+      case 'e':
+        ok = unpack<long double>(data, value);
+        break;
+      case 'p':
+        ok = unpack<const void*>(data, value);
+        break;
+      case 'n':
+        ok = unpack<std::nullptr_t>(data, value);
+        break;
+      case 's': {
+        std::uint32_t size;
+        ok = data.size() >= sizeof(size);
+        if (ok) {
+          std::memcpy(&size, data.data(), sizeof(size));
+          data.remove_prefix(sizeof(size));
+          // 空指针无法格式化，整条按无法解码处理
+          ok = size != deferred_null_string && data.size() >= size;
+          if (ok) {
+            value = data.substr(0, size);
+            data.remove_prefix(size);
+          }
+        }
+        break;
+      }
+      default:
+        ok = false;
+        break;
+    }
+
+    if (!ok) return false;
+  }
+
+  return true;
+}
+
+auto parse_arg_id(const std::string_view id, std::size_t& next)
+    -> std::size_t {
+  if (id.empty()) return next++;
+
+  std::size_t index = 0;
+  if (std::from_chars(id.data(), id.data() + id.size(), index).ec !=
+      std::errc{}) {
+    throw std::format_error("invalid argument id");
+  }
+  return index;
+}
+
+// 离线解码时没有参数的静态类型，只能逐个替换字段格式化
+void format_packed(const std::string_view fmt,
+                   const detail::vector<packed_value>& values,
+                   detail::buffer_1k& out) {
+  std::size_t next = 0;
+  std::size_t i = 0;
+  detail::string field_fmt;
+  while (i < fmt.size()) {
+    if (fmt[i] == '}') {
+      out.push_back('}');
+      i += i + 1 < fmt.size() && fmt[i + 1] == '}' ? 2 : 1;
+      continue;
+    }
+
+    if (fmt[i] != '{') {
+      const auto end = (std::min)(fmt.find_first_of("{}", i), fmt.size());
+      out.append(fmt.substr(i, end - i));
+      i = end;
+      continue;
+    }
+
+    if (i + 1 < fmt.size() && fmt[i + 1] == '{') {
+      out.push_back('{');
+      i += 2;
+      continue;
+    }
+
+    std::size_t end = i + 1;
+    for (std::uint32_t depth = 1; end < fmt.size(); ++end) {
+      if (fmt[end] == '{') {
+        ++depth;
+      } else if (fmt[end] == '}' && --depth == 0) {
+        break;
+      }
+    }
+    if (end >= fmt.size()) throw std::format_error("unmatched '{'");
+
+    const auto field = fmt.substr(i + 1, end - i - 1);
+    i = end + 1;
+    const auto colon = field.find(':');
+    const auto& value = values.at(parse_arg_id(field.substr(0, colon), next));
+
+    // 动态宽度和精度替换为对应参数的值
+    field_fmt = "{";
+    if (colon != std::string_view::npos) {
+      const auto spec = field.substr(colon);
+      for (std::size_t pos = 0; pos < spec.size();) {
+        if (spec[pos] != '{') {
+          field_fmt.push_back(spec[pos++]);
+          continue;
+        }
+
+        const auto close = spec.find('}', pos);
+        if (close == std::string_view::npos) {
+          throw std::format_error("unmatched '{'");
+        }
+        const auto& nested = values.at(
+            parse_arg_id(spec.substr(pos + 1, close - pos - 1), next));
+        std::visit(
+            [&field_fmt](const auto& v) {
+              using type = std::decay_t<decltype(v)>;
+              if constexpr (std::same_as<type, std::int64_t> ||
+                            std::same_as<type, std::uint64_t>) {
+                std::format_to(std::back_inserter(field_fmt), "{}", v);
+              } else {
+                throw std::format_error("width is not an integer");
+              }
+            },
+            nested);
+        pos = close + 1;
+      }
+    }
+    field_fmt.push_back('}');
+
+    std::visit(
+        [&](const auto& v) {
+          std::vformat_to(std::back_inserter(out), field_fmt,
+                          std::make_format_args(v));
+        },
+        value);
+  }
+}
+
+auto decode_binary_log(std::istream& input, std::ostream& output) -> bool {
+  struct site {
+    level lv{level::off};
+    std::uint32_t line{0};
+    detail::string file;
+    detail::string fmt;
+    detail::string signature;
+  };
+
+  binary_reader reader(input);
+  default_formatter formatter;
+  detail::vector<site> sites;
+  detail::vector<packed_value> values;
+  detail::string data;
+  detail::buffer_1k text;
+  detail::buffer_1k line;
+  std::int64_t last_ns = 0;
+  while (true) {
+    std::uint8_t tag;
+    if (!reader.read_u8(tag)) return true;
+
+    if (tag == static_cast<std::uint8_t>(binary_magic[0])) {
+      std::uint8_t byte;
+      for (const char ch : binary_magic.substr(1)) {
+        if (!reader.read_u8(byte) || byte != static_cast<std::uint8_t>(ch)) {
+          return false;
+        }
+      }
+
+      std::uint64_t base;
+      if (!reader.read_u8(byte) || byte != binary_version ||
+          !reader.read_varint(base)) {
+        return false;
+      }
+      last_ns = unzigzag(base);
+      sites.clear();
+      continue;
+    }
+
+    if (tag == tag_site) {
+      std::uint64_t id, line_no;
+      std::uint8_t lv;
+      site s;
+      if (!reader.read_varint(id) || !reader.read_u8(lv) ||
+          !reader.read_varint(line_no) || !reader.read_bytes(s.file) ||
+          !reader.read_bytes(s.fmt) || !reader.read_bytes(s.signature)) {
+        return false;
+      }
+      s.lv = static_cast<level>(lv);
+      s.line = static_cast<std::uint32_t>(line_no);
+      if (id >= sites.size()) sites.resize(id + 1);
+      sites[id] = std::move(s);
+      continue;
+    }
+
+    if (tag != tag_text && tag != tag_args) return false;
+
+    std::uint64_t delta, tid, sid, id;
+    if (!reader.read_varint(delta) || !reader.read_varint(tid) ||
+        !reader.read_varint(sid) || !reader.read_varint(id) ||
+        !reader.read_bytes(data) || id >= sites.size()) {
+      return false;
+    }
+    last_ns += unzigzag(delta);
+
+    const auto& s = sites[id];
+    text.clear();
+    if (tag == tag_text) {
+      text.append(data);
+    } else {
+      try {
+        if (!unpack_args(s.signature, data, values)) return false;
+        format_packed(s.fmt, values, text);
+      } catch (...) {
+        text.clear();
+        text.append(s.fmt);
+      }
+    }
+
+    using namespace std::chrono;
+    const system_clock::time_point point(
+        duration_cast<system_clock::duration>(nanoseconds(last_ns)));
+    std::size_t color_start, color_stop;
+    line.clear();
+    formatter.format(point, s.lv, tid, static_cast<std::uint32_t>(sid), s.file,
+                     s.line, static_cast<std::string_view>(text), line,
+                     color_start, color_stop);
+    output.write(reinterpret_cast<const char*>(line.begin_read()),
+                 static_cast<std::streamsize>(line.readable()));
+  }
+}
+
+}  // namespace jt::log
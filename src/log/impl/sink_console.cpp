@@ -85,6 +85,28 @@ class sink_console_impl {
     }
   }
 
+  void write_batch(const std::span<const sink::batch_line> lines,
+                   const detail::buffer_1k& buf) {
+    std::lock_guard lock(mutex_);
+    if (!enable_color_) {
+      // 各行在缓冲区中是连续的，一次写出
+      write_range(buf, lines.front().start, lines.back().stop);
+      return;
+    }
+
+    for (const auto& line : lines) {
+      if (line.color_stop > line.color_start) {
+        write_range(buf, line.start, line.color_start);
+        set_color(line.lv);
+        write_range(buf, line.color_start, line.color_stop);
+        reset_color();
+        write_range(buf, line.color_stop, line.stop);
+      } else {
+        write_range(buf, line.start, line.stop);
+      }
+    }
+  }
+
   void flush_unlock() {
 #ifndef _WIN32
     std::lock_guard lock(mutex_);
@@ -220,8 +242,15 @@ void sink_stdout::write(const level lv, const time_point&,
   return impl_.write(lv, buf, color_start, color_stop);
 }
 
+void sink_stdout::write_batch(const std::span<const batch_line> lines,
+                              const detail::buffer_1k& buf) {
+  return impl_.write_batch(lines, buf);
+}
+
 void sink_stdout::flush_unlock() { return impl_.flush_unlock(); }
 
+auto sink_stdout::crash_prepare() noexcept -> int { return 1; }
+
 sink_stderr::sink_stderr() : impl_(console_stderr) {}
 
 sink_stderr::~sink_stderr() noexcept = default;
@@ -233,8 +262,15 @@ void sink_stderr::write(const level lv, const time_point&,
   return impl_.write(lv, buf, color_start, color_stop);
 }
 
+void sink_stderr::write_batch(const std::span<const batch_line> lines,
+                              const detail::buffer_1k& buf) {
+  return impl_.write_batch(lines, buf);
+}
+
 void sink_stderr::flush_unlock() { return impl_.flush_unlock(); }
 
+auto sink_stderr::crash_prepare() noexcept -> int { return 2; }
+
 void write_stdout(const detail::buffer_1k& buf) {
   console_stdout.write(level::info, buf, 0, buf.readable());
 }
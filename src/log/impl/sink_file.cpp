@@ -1,17 +1,33 @@
 module;
 
+#include <lz4frame.h>
 #include <simdjson.h>
 
 // module jt:log.sink.file;
 module jt;
 
 import std;
+import :detail.cpu_pause;
+import :detail.file;
 
 namespace jt::log {
 
+static constexpr LZ4F_preferences_t inline_lz4_preferences = {
+    {LZ4F_max256KB, LZ4F_blockLinked, LZ4F_noContentChecksum, LZ4F_frame,
+     0 /* unknown content size */, 0 /* no dictID */, LZ4F_noBlockChecksum},
+    0,         /* compression level; 0 == default */
+    0,         /* auto flush */
+    0,         /* favor decompression speed */
+    {0, 0, 0}, /* reserved, must be set to 0 */
+};
+
+// 每次交给 LZ4F_compressUpdate 的最大字节数
+constexpr std::size_t inline_lz4_input_size = 64ull * 1024;
+
 class sink_file_imp {
  public:
-  explicit sink_file_imp(service& s, const sink_file_config& config)  // NOLINT
+  sink_file_imp(service& s, const sink_file_config& config,  // NOLINT
+                const sink_file_storage& storage)
       : service_(s),
         max_size_(config.max_size),
         daily_rotation_(config.daily_rotation),
@@ -19,9 +35,33 @@ class sink_file_imp {
     name_ = config.name;
     directory_ = config.directory;
     lz4_directory_ = config.lz4_directory;
+    extension_ = storage.extension;
+    mapped_ = storage.mapped;
+    msync_ = storage.sync;
+    buffer_size_ = config.buffer_size;
+    fsync_ = config.fsync;
+    fsync_interval_ = config.fsync_interval;
+    if (!mapped_) {
+      staging_.reserve(buffer_size_);
+    }
+    if (config.lz4_inline && !mapped_) {
+      if (const auto ec =
+              LZ4F_createCompressionContext(&lz4_ctx_, LZ4F_VERSION);
+          LZ4F_isError(ec)) {
+        print_stderr("create lz4 context fail, {}\n", LZ4F_getErrorName(ec));
+        lz4_ctx_ = nullptr;
+      } else {
+        extension_ += ".lz4";
+        lz4_out_.resize(
+            LZ4F_compressBound(inline_lz4_input_size, &inline_lz4_preferences));
+      }
+    }
+    if (config.async_io && !mapped_ && lz4_ctx_ == nullptr) {
+      async_ = uring_.init(uring_depth);
+    }
 
     detail::buffer_1k temp;
-    std::format_to(std::back_inserter(temp), "manifest_{}.json", name_);
+    detail::format_to(temp, "manifest_{}.json", name_);
 
     std::u8string_view u8strv(
         reinterpret_cast<const char8_t*>(directory_.c_str()),
@@ -40,7 +80,49 @@ class sink_file_imp {
     create_directories(lz4_directory, ec);
   }
 
+  ~sink_file_imp() noexcept {
+    if (is_open()) {
+      write_staging();
+      wait_async();
+      lz4_end();
+    }
+    if (lz4_ctx_ != nullptr) {
+      LZ4F_freeCompressionContext(lz4_ctx_);
+    }
+  }
+
+  sink_file_imp(const sink_file_imp&) = delete;
+  sink_file_imp(sink_file_imp&&) = delete;
+  auto operator=(const sink_file_imp&) -> sink_file_imp& = delete;
+  auto operator=(sink_file_imp&&) -> sink_file_imp& = delete;
+
   void write(const sink::time_point& point, const detail::buffer_1k& buf) {
+    if (!prepare(point)) return;
+
+    return append(buf.begin_read(), buf.readable());
+  }
+
+  void write_batch(std::span<const sink::batch_line> lines,
+                   const detail::buffer_1k& buf) {
+    while (!lines.empty()) {
+      if (!prepare(lines.front().point)) return;
+
+      // 不需要轮换的连续多行一次写入
+      std::size_t count = 1;
+      while (count < lines.size() && !(tomorrow_ < lines[count].point) &&
+             file_size_ + (lines[count].start - lines.front().start) <
+                 max_size_) {
+        ++count;
+      }
+
+      const auto start = lines.front().start;
+      append(buf.begin_read() + start, lines[count - 1].stop - start);
+      lines = lines.subspan(count);
+    }
+  }
+
+  // 按时间和大小检查是否需要轮换，并确保文件已打开
+  auto prepare(const sink::time_point& point) -> bool {
     if (tomorrow_ < point) {
       const auto old_day = manifest_.day;
       tomorrow_ =
@@ -58,25 +140,300 @@ class sink_file_imp {
       rotate();
     }
 
-    if (!file_.is_open()) {
+    if (!is_open()) {
       file_open();
-      if (!file_.is_open()) {
-        return;
+      if (!is_open()) {
+        return false;
       }
     }
 
-    file_.write(reinterpret_cast<const char*>(buf.begin_read()),
-                static_cast<std::streamsize>(buf.readable()));
-    file_size_ += buf.readable();
+    return true;
   }
 
-  void flush_unlock() {  // NOLINT(*-convert-member-functions-to-static)
-    if (file_.is_open()) {
-      file_.flush();
+  // 先写进缓存，缓存放不下时和缓存中的内容一起写入文件
+  void append(const void* data, const std::size_t size) {
+    if (mapped_) {
+      return append_mapped(data, size);
+    }
+
+    // 压缩模式下 file_size_ 是写入磁盘的压缩后大小
+    if (lz4_ctx_ == nullptr) {
+      file_size_ += size;
+    }
+    if (size <= staging_.writable()) {
+      staging_.append(data, size);
+      return;
+    }
+
+    if (lz4_ctx_ != nullptr) {
+      write_staging();
+      return lz4_update(data, size);
+    }
+
+    if (async_) {
+      write_staging();
+      staging_.reserve(size);
+      staging_.append(data, size);
+      return;
+    }
+
+    const detail::read_buffer buffers[] = {
+        {staging_.begin_read(), staging_.readable()}, {data, size}};
+    write_file(buffers);
+    staging_.clear();
+    dirty_ = true;
+  }
+
+  // 每打开一个文件加1
+  [[nodiscard]] auto file_sequence() const noexcept -> std::uint64_t {
+    return file_sequence_;
+  }
+
+  // 压缩模式下同时输出当前的 LZ4 块，保证已写入的日志可以解压
+  void flush_unlock() {
+    if (mapped_) {
+      return sync_mapped();
     }
+
+    write_staging();
+    wait_async();
+    if (lz4_ctx_ == nullptr || !file_.is_open()) {
+      if (fsync_ == fsync_policy::flush) sync_file();
+      return;
+    }
+
+    const auto size =
+        LZ4F_flush(lz4_ctx_, lz4_out_.data(), lz4_out_.size(), nullptr);
+    if (LZ4F_isError(size)) {
+      return print_stderr("lz4 flush fail, {}\n", LZ4F_getErrorName(size));
+    }
+    write_raw(lz4_out_.data(), size);
+    if (fsync_ == fsync_policy::flush) sync_file();
+  }
+
+  auto end_batch_unlock() -> std::chrono::steady_clock::time_point {
+    write_staging();
+    return sync_unlock();
+  }
+
+  auto sync_unlock() -> std::chrono::steady_clock::time_point {
+    if (fsync_ != fsync_policy::interval || !dirty_ || !file_.is_open()) {
+      return std::chrono::steady_clock::time_point::max();
+    }
+
+    if (std::chrono::steady_clock::now() - last_fsync_ >= fsync_interval_) {
+      sync_file();
+      if (!dirty_) return std::chrono::steady_clock::time_point::max();
+    }
+    return last_fsync_ + fsync_interval_;
+  }
+
+  // 写线程修改暂存区和文件期间持有；崩溃处理取得后不再释放，
+  // 之后写线程在这里一直等待，直到信号处理结束后进程按原来的信号退出。
+  // 原来的处理函数不退出进程时，写线程会永远阻塞在这个 sink 上
+  class write_guard {
+   public:
+    explicit write_guard(std::atomic<bool>& busy) noexcept : busy_(busy) {
+      while (busy_.exchange(true, std::memory_order::acquire)) {
+        std::this_thread::yield();
+      }
+    }
+
+    ~write_guard() noexcept { busy_.store(false, std::memory_order::release); }
+
+    write_guard(const write_guard&) = delete;
+    write_guard(write_guard&&) = delete;
+    auto operator=(const write_guard&) -> write_guard& = delete;
+    auto operator=(write_guard&&) -> write_guard& = delete;
+
+   private:
+    std::atomic<bool>& busy_;
+  };
+
+  [[nodiscard]] auto guard() noexcept -> write_guard {
+    return write_guard{busy_};
+  }
+
+  // 多个 logger 共用这个 sink 时会调用多次，只有第一次写出暂存区
+  auto crash_prepare() noexcept -> int {
+    if (crash_fd_ != crash_unprepared) return crash_fd_;
+    crash_fd_ = -1;
+
+    // 写线程正在写入时暂存区和文件位置都不可靠，稍等片刻；
+    // 崩溃发生在写入过程中时等不到，放弃这个 sink
+    std::uint32_t spin = 0;
+    while (busy_.exchange(true, std::memory_order::acquire)) {
+      if (++spin == 1u << 20) return -1;
+      detail::cpu_pause();
+    }
+
+    if (mapped_ || lz4_ctx_ != nullptr || !file_.is_open()) return -1;
+
+    // 异步写入按偏移进行，文件位置没有移动
+    if (async_ && !file_.seek(write_offset_)) return -1;
+
+    std::error_code ec;
+    const detail::read_buffer buffers[] = {
+        {staging_.begin_read(), staging_.readable()}};
+    file_.write(buffers, ec);
+    staging_.clear();
+    crash_fd_ = file_.native_handle();
+    return crash_fd_;
   }
 
  private:
+  [[nodiscard]] auto is_open() const noexcept -> bool {
+    return mapped_ ? mapped_file_.is_open() : file_.is_open();
+  }
+
+  // 直接拷贝到映射的文件段，段写满时轮换到新的段
+  void append_mapped(const void* data, const std::size_t size) {
+    if (!mapped_file_.write(data, size)) {
+      rotate();
+      file_open(size);
+      if (!is_open()) return;
+
+      if (mapped_) {
+        mapped_file_.write(data, size);
+      } else {
+        return append(data, size);
+      }
+    }
+    file_size_ = mapped_file_.size();
+  }
+
+  // 上次落盘之后没有写入时跳过
+  void sync_file() noexcept {
+    if (!dirty_ || !file_.is_open()) return;
+
+    dirty_ = false;
+    last_fsync_ = std::chrono::steady_clock::now();
+    if (async_) {
+      // 排在已提交的写入之后
+      uring_.fsync(file_.native_handle());
+      return wait_async();
+    }
+
+    if (std::error_code ec; !file_.sync(ec)) {
+      print_stderr("fsync fail, {}\n",
+                   detail::system_category().message(ec.value()));
+    }
+  }
+
+  void sync_mapped() {
+    if (msync_ == msync_policy::none || !mapped_file_.is_open()) return;
+
+    if (std::error_code ec;
+        !mapped_file_.sync(msync_ == msync_policy::async, ec)) {
+      print_stderr("msync fail, {}\n",
+                   detail::system_category().message(ec.value()));
+    }
+  }
+
+  void write_staging() noexcept {
+    if (staging_.readable() == 0) return;
+
+    if (file_.is_open()) {
+      dirty_ = true;
+      if (lz4_ctx_ != nullptr) {
+        lz4_update(staging_.begin_read(), staging_.readable());
+      } else if (async_) {
+        // 缓冲区交给 io_uring，换回一个空闲的缓冲区
+        const auto offset = write_offset_;
+        write_offset_ += staging_.readable();
+        uring_.write(file_.native_handle(), offset, staging_);
+        staging_.reserve(buffer_size_);
+      } else {
+        const detail::read_buffer buffers[] = {
+            {staging_.begin_read(), staging_.readable()}};
+        write_file(buffers);
+      }
+    }
+    staging_.clear();
+  }
+
+  // 等待 io_uring 中在途的写入完成
+  void wait_async() noexcept {
+    if (!async_) return;
+
+    if (const auto ec = uring_.wait_all()) {
+      print_stderr("async write fail, {}\n",
+                   detail::system_category().message(ec.value()));
+    }
+  }
+
+  // 直接写入文件，不经过缓存
+  void write_raw(const void* data, const std::size_t size) noexcept {
+    if (size == 0) return;
+
+    const detail::read_buffer buffers[] = {{data, size}};
+    file_size_ += size;
+    write_file(buffers);
+    dirty_ = true;
+  }
+
+  // 同步写入文件。失败时丢弃这些数据，file_size_ 改为文件的实际大小，
+  // 轮换仍然准确；连续失败只在第一次和恢复时报告，部分写入也计入丢弃
+  void write_file(const std::span<const detail::read_buffer> buffers) noexcept {
+    std::error_code ec;
+    if (file_.write(buffers, ec)) {
+      if (dropped_bytes_ > 0) {
+        print_stderr("write recovered, {} bytes dropped\n", dropped_bytes_);
+        dropped_bytes_ = 0;
+      }
+      return;
+    }
+
+    if (dropped_bytes_ == 0) {
+      print_stderr("write fail, {}\n",
+                   detail::system_category().message(ec.value()));
+    }
+    for (const auto& buf : buffers) {
+      dropped_bytes_ += buf.capacity();
+    }
+    if (const auto size = file_.size(ec); !ec) file_size_ = size;
+  }
+
+  // 每个压缩文件只有一个 frame，见 file_open
+  void lz4_begin() noexcept {
+    if (lz4_ctx_ == nullptr) return;
+
+    const auto size = LZ4F_compressBegin(lz4_ctx_, lz4_out_.data(),
+                                         lz4_out_.size(),
+                                         &inline_lz4_preferences);
+    if (LZ4F_isError(size)) {
+      return print_stderr("lz4 begin fail, {}\n", LZ4F_getErrorName(size));
+    }
+    write_raw(lz4_out_.data(), size);
+  }
+
+  void lz4_update(const void* data, std::size_t size) noexcept {
+    const auto* ptr = static_cast<const char*>(data);
+    while (size > 0) {
+      const auto chunk = (std::min)(size, inline_lz4_input_size);
+      const auto compressed = LZ4F_compressUpdate(
+          lz4_ctx_, lz4_out_.data(), lz4_out_.size(), ptr, chunk, nullptr);
+      if (LZ4F_isError(compressed)) {
+        return print_stderr("lz4 compress fail, {}\n",
+                            LZ4F_getErrorName(compressed));
+      }
+      write_raw(lz4_out_.data(), compressed);
+      ptr += chunk;
+      size -= chunk;
+    }
+  }
+
+  void lz4_end() noexcept {
+    if (lz4_ctx_ == nullptr) return;
+
+    const auto size =
+        LZ4F_compressEnd(lz4_ctx_, lz4_out_.data(), lz4_out_.size(), nullptr);
+    if (LZ4F_isError(size)) {
+      return print_stderr("lz4 end fail, {}\n", LZ4F_getErrorName(size));
+    }
+    write_raw(lz4_out_.data(), size);
+  }
+
   void load_manifest() {
     std::ifstream manifest(manifest_path_, std::ios_base::binary);
     if (!manifest.is_open()) {
@@ -118,17 +475,27 @@ class sink_file_imp {
   void save_manifest() {
     std::ofstream file(manifest_path_, std::ios::binary);
     detail::buffer_1k temp;
-    std::format_to(std::back_inserter(temp), R"({{ "day":{}, "seq":{} }})",
-                   manifest_.day, manifest_.seq);
+    detail::format_to(temp, R"({{ "day":{}, "seq":{} }})", manifest_.day,
+                      manifest_.seq);
     file.write(reinterpret_cast<const char*>(temp.begin_read()),
                static_cast<std::streamsize>(temp.readable()));
   }
 
   void rotate() {
-    if (file_.is_open()) {
+    if (is_open()) {
+      write_staging();
+      wait_async();
+      lz4_end();
+      // 开启落盘时，轮换前的内容也要落盘
+      if (fsync_ != fsync_policy::none) sync_file();
       file_.close();
+      mapped_file_.close();
       file_size_ = 0;
-      service_.post_lz4(file_name_, lz4_directory_);
+      if (lz4_ctx_ != nullptr) {
+        move_to_lz4_directory();
+      } else {
+        service_.post_lz4(file_name_, lz4_directory_);
+      }
     }
 
     const std::chrono::year_month_day today{tomorrow_ - std::chrono::days{1}};
@@ -145,14 +512,33 @@ class sink_file_imp {
     }
   }
 
-  void file_open() {
+  // 压缩模式下文件已经是 .lz4，直接移动到 lz4 目录
+  void move_to_lz4_directory() {
+    const std::u8string_view u8strv(
+        reinterpret_cast<const char8_t*>(lz4_directory_.c_str()),
+        lz4_directory_.size());
+    std::filesystem::path dest = u8strv;
+    dest /= file_name_.filename();
+    std::error_code ec;
+    std::filesystem::rename(file_name_, dest, ec);
+    if (ec) {
+      const auto str = file_name_.generic_u8string();
+      print_stderr(
+          "move {} fail, {}\n",
+          std::string_view{reinterpret_cast<const char*>(str.c_str()),
+                           str.size()},
+          detail::system_category().message(ec.value()));
+    }
+  }
+
+  // min_capacity 为映射文件段的最小大小
+  void file_open(const std::size_t min_capacity = 0) {
     detail::buffer_1k temp;
     if (manifest_.seq == 0) {  // NOLINT(*-branch-clone)
-      std::format_to(std::back_inserter(temp), "{}_{}.log", name_,
-                     manifest_.day);
+      detail::format_to(temp, "{}_{}{}", name_, manifest_.day, extension_);
     } else {
-      std::format_to(std::back_inserter(temp), "{}_{}_{:04d}.log", name_,
-                     manifest_.day, manifest_.seq);
+      detail::format_to(temp, "{}_{}_{:04d}{}", name_, manifest_.day,
+                        manifest_.seq, extension_);
     }
 
     std::u8string_view u8strv(
@@ -162,16 +548,44 @@ class sink_file_imp {
     u8strv = {reinterpret_cast<const char8_t*>(temp.begin_read()),
               temp.readable()};
     file_name_ /= u8strv;
-    if (std::filesystem::exists(file_name_)) {
-      file_size_ = std::filesystem::file_size(file_name_);
+    std::error_code ec;
+    if (mapped_) {
+      if (mapped_file_.open(file_name_, (std::max)(max_size_, min_capacity),
+                            ec)) {
+        file_size_ = mapped_file_.size();
+        ++file_sequence_;
+        return;
+      }
+
+      // 不支持映射时退回普通写入
+      print_stderr("map {} fail, {}\n", static_cast<std::string_view>(temp),
+                   detail::system_category().message(ec.value()));
+      mapped_ = false;
+    }
+
+    if (!file_.open(file_name_, ec, !async_)) return;
+
+    file_size_ = file_.size(ec);
+    // 已有的压缩文件在崩溃时缺少结束标记，之后追加的 frame 无法解码；
+    // 把它当作已经轮换的文件移走，换下一个序号重新打开
+    if (lz4_ctx_ != nullptr && file_size_ > 0) {
+      file_.close();
+      file_size_ = 0;
+      move_to_lz4_directory();
+      ++manifest_.seq;
+      save_manifest();
+      return file_open(min_capacity);
     }
-    file_.open(file_name_, std::ios::binary | std::ios::app);
+    write_offset_ = file_size_;
+    ++file_sequence_;
+    lz4_begin();
   }
 
   service& service_;
   detail::string name_{};
   detail::string directory_{};
   detail::string lz4_directory_{};
+  detail::string extension_{};
   std::size_t max_size_;
   bool daily_rotation_;
   std::uint32_t keep_days_;
@@ -184,22 +598,89 @@ class sink_file_imp {
   };
   manifest manifest_{};
   std::filesystem::path manifest_path_;
-  std::ofstream file_;
+  detail::append_file file_;
+  bool mapped_{false};
+  msync_policy msync_{msync_policy::none};
+  detail::mapped_file mapped_file_;
+  detail::buffer_1k staging_;
+  std::atomic<bool> busy_{false};
+  static constexpr int crash_unprepared = -2;
+  int crash_fd_{crash_unprepared};
+  std::size_t buffer_size_{0};
+  // 同时在途的 io_uring 写入数
+  static constexpr unsigned uring_depth = 8;
+  bool async_{false};
+  detail::uring_writer uring_;
+  std::uint64_t write_offset_{0};
+  fsync_policy fsync_{fsync_policy::none};
+  std::chrono::milliseconds fsync_interval_{1000};
+  std::chrono::steady_clock::time_point last_fsync_{};
+  // 上次落盘之后有新的写入
+  bool dirty_{false};
+  // 写入失败以来丢弃的字节数
+  std::uint64_t dropped_bytes_{0};
+  LZ4F_compressionContext_t lz4_ctx_{nullptr};
+  detail::vector<char> lz4_out_;
   std::filesystem::path file_name_;
   std::size_t file_size_{0};
+  std::uint64_t file_sequence_{0};
   std::chrono::sys_days tomorrow_{};
 };
 
 sink_file::sink_file(service& s, const sink_file_config& config)  // NOLINT
-    : impl_(detail::make_unique<sink_file_imp>(s, config)) {}
+    : sink_file(s, config, sink_file_storage{}) {}
+
+sink_file::sink_file(service& s, const sink_file_config& config,  // NOLINT
+                     const sink_file_storage& storage)
+    : impl_(detail::make_unique<sink_file_imp>(s, config, storage)) {}
 
 sink_file::~sink_file() noexcept = default;
 
 void sink_file::write(level, const time_point& point,
                       const detail::buffer_1k& buf, std::size_t, std::size_t) {
+  const auto guard = impl_->guard();
   return impl_->write(point, buf);
 }
 
-void sink_file::flush_unlock() { return impl_->flush_unlock(); }
+void sink_file::write_batch(const std::span<const batch_line> lines,
+                            const detail::buffer_1k& buf) {
+  const auto guard = impl_->guard();
+  return impl_->write_batch(lines, buf);
+}
+
+void sink_file::flush_unlock() {
+  const auto guard = impl_->guard();
+  return impl_->flush_unlock();
+}
+
+auto sink_file::end_batch_unlock() -> std::chrono::steady_clock::time_point {
+  const auto guard = impl_->guard();
+  return impl_->end_batch_unlock();
+}
+
+auto sink_file::sync_unlock() -> std::chrono::steady_clock::time_point {
+  const auto guard = impl_->guard();
+  return impl_->sync_unlock();
+}
+
+auto sink_file::crash_prepare() noexcept -> int {
+  return impl_->crash_prepare();
+}
+
+// ReSharper disable once CppMemberFunctionMayBeConst
+auto sink_file::prepare(const time_point& point) -> bool {
+  const auto guard = impl_->guard();
+  return impl_->prepare(point);
+}
+
+// ReSharper disable once CppMemberFunctionMayBeConst
+void sink_file::append(const void* data, const std::size_t size) {
+  const auto guard = impl_->guard();
+  return impl_->append(data, size);
+}
+
+auto sink_file::file_sequence() const noexcept -> std::uint64_t {
+  return impl_->file_sequence();
+}
 
 }  // namespace jt::log
\ No newline at end of file
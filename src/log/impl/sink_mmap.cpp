@@ -0,0 +1,14 @@
+// module jt:log.sink.mmap;
+module jt;
+
+import std;
+
+namespace jt::log {
+
+sink_mmap::sink_mmap(service& s, const sink_mmap_config& config)  // NOLINT
+    : sink_file(s, config,
+                sink_file_storage{.mapped = true, .sync = config.sync}) {}
+
+sink_mmap::~sink_mmap() noexcept = default;
+
+}  // namespace jt::log
@@ -0,0 +1,135 @@
+// module jt:log.site;
+module jt;
+
+import std;
+import :log.site;
+
+namespace jt::log {
+
+std::atomic<std::uint32_t> enabled_site_rules{0};
+
+namespace {
+
+struct site_rule {
+  std::string file_name;
+  std::uint_least32_t line{0};
+  bool enabled{false};
+};
+
+class site_registry {
+ public:
+  auto get(const std::source_location& source, const level lv,
+           const std::string_view fmt) -> const site& {
+    const auto hash = hash_of(source, lv, fmt);
+    auto& bucket = buckets_[hash % buckets_.size()];
+    if (const site* s = find(bucket.load(std::memory_order::acquire), source,
+                             lv, fmt)) {
+      return *s;
+    }
+
+    std::lock_guard lock(mutex_);
+    // 加锁前可能已被其他线程注册
+    if (const site* s = find(bucket.load(std::memory_order::relaxed), source,
+                             lv, fmt)) {
+      return *s;
+    }
+
+    auto& s = sites_.emplace_back();
+    s.lv = lv;
+    s.line = source.line();
+    s.column = source.column();
+    s.file_path = source.file_name();
+    s.file_name = s.file_path;
+    if (const auto pos = s.file_name.find_last_of("/\\");
+        pos != std::string_view::npos) {
+      s.file_name = s.file_name.substr(pos + 1);
+    }
+    s.function_name = source.function_name();
+    s.fmt = fmt;
+    for (const auto& rule : rules_) {
+      if (rule.line == s.line && rule.file_name == s.file_name) {
+        s.enabled.store(rule.enabled, std::memory_order::relaxed);
+      }
+    }
+    s.next = bucket.load(std::memory_order::relaxed);
+    bucket.store(&s, std::memory_order::release);
+    return s;
+  }
+
+  void set_enabled(const std::string_view file_name,
+                   const std::uint_least32_t line, const bool enabled) {
+    std::lock_guard lock(mutex_);
+    const auto it = std::ranges::find_if(rules_, [&](const site_rule& rule) {
+      return rule.line == line && rule.file_name == file_name;
+    });
+    if (it != rules_.end()) {
+      it->enabled = enabled;
+    } else {
+      rules_.push_back({std::string(file_name), line, enabled});
+    }
+
+    for (auto& s : sites_) {
+      if (s.line == line && s.file_name == file_name) {
+        s.enabled.store(enabled, std::memory_order::relaxed);
+      }
+    }
+
+    enabled_site_rules.store(
+        static_cast<std::uint32_t>(
+            std::ranges::count_if(rules_, &site_rule::enabled)),
+        std::memory_order::relaxed);
+  }
+
+ private:
+  static auto hash_of(const std::source_location& source, const level lv,
+                      const std::string_view fmt) noexcept -> std::size_t {
+    std::size_t seed = std::hash<const void*>{}(source.file_name());
+    const auto combine = [&seed](const std::size_t value) {
+      seed ^= value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2);
+    };
+    combine(source.line());
+    combine(source.column());
+    combine(static_cast<std::size_t>(lv));
+    combine(std::hash<const void*>{}(fmt.data()));
+    return seed;
+  }
+
+  static auto find(const site* s, const std::source_location& source,
+                   const level lv, const std::string_view fmt) noexcept
+      -> const site* {
+    for (; s != nullptr; s = s->next) {
+      if (s->file_path.data() == source.file_name() &&
+          s->line == source.line() && s->column == source.column() &&
+          s->lv == lv && s->fmt.data() == fmt.data()) {
+        return s;
+      }
+    }
+    return nullptr;
+  }
+
+  std::array<std::atomic<const site*>, 4096> buckets_{};
+  std::mutex mutex_;
+  // 调用点的地址不能变化
+  std::deque<site> sites_;
+  std::vector<site_rule> rules_;
+};
+
+// 调用点在程序结束前都可能被使用，不析构
+auto registry() -> site_registry& {
+  static auto* r = new site_registry;
+  return *r;
+}
+
+}  // namespace
+
+auto get_site(const std::source_location& source, const level lv,
+              const std::string_view fmt) -> const site& {
+  return registry().get(source, lv, fmt);
+}
+
+void set_site_enabled(const std::string_view file_name,
+                      const std::uint_least32_t line, const bool enabled) {
+  return registry().set_enabled(file_name, line, enabled);
+}
+
+}  // namespace jt::log
@@ -0,0 +1,97 @@
+export module jt:log.json_formatter;
+
+import std;
+import :detail.json;
+import :log.formatter;
+import :log.level;
+import :log.message;
+
+export namespace jt::log {
+
+/**
+ * 每条日志输出为一行 JSON（JSON Lines）
+ * @code
+ * {"ts":"2024-01-01T00:00:00.000000Z","lv":"info","tid":1,"sid":0,
+ *  "file":"main.cpp","line":10,"msg":"hello"}
+ * @endcode
+ * 时间为 UTC，颜色范围是等级的值，不含引号。
+ * 配合 sink_file 使用：s->set_formatter(make_dynamic_unique<formatter,
+ * json_formatter>())。
+ */
+class json_formatter final : public formatter {
+ public:
+  void format(const message& msg, detail::buffer_1k& buf,  // NOLINT
+              std::size_t& color_start, std::size_t& color_stop) override {
+    return format(msg.point, msg.lv, msg.tid, msg.sid, msg.where->file_name,
+                  msg.where->line, static_cast<std::string_view>(msg.buf),
+                  buf, color_start, color_stop);
+  }
+
+  [[nodiscard]] auto is_concurrent() const noexcept -> bool override {
+    return true;
+  }
+
+  [[nodiscard]] auto share_key() const noexcept -> const void* override {
+    return &typeid(json_formatter);
+  }
+
+  // 不依赖 message 的版本
+  void format(const std::chrono::system_clock::time_point& point,  // NOLINT
+              const level lv, const std::uint64_t tid, const std::uint32_t sid,
+              std::string_view file_name, const std::uint_least32_t line,
+              const std::string_view text, detail::buffer_1k& buf,
+              std::size_t& color_start, std::size_t& color_stop) {
+    using namespace std::chrono;
+    auto& date = date_;
+    const auto current_second = floor<seconds>(point);
+    if (current_second != date.last_second) {
+      date.last_second = current_second;
+      date.text.clear();
+      detail::format_to(date.text, "{:%Y-%m-%dT%H:%M:%S}.", current_second);
+    }
+
+    buf.append(R"({"ts":")", 7);
+    buf.append(date.text.begin_read(), date.text.readable());
+    auto micros = static_cast<std::uint32_t>(
+        duration_cast<microseconds>(point - current_second).count());
+    char fraction[] = {'0', '0', '0', '0', '0', '0', 'Z', '"'};
+    for (std::size_t i = 6; i > 0; --i) {
+      fraction[i - 1] = static_cast<char>('0' + micros % 10);
+      micros /= 10;
+    }
+    buf.append(fraction, sizeof(fraction));
+
+    buf.append(R"(,"lv":")", 7);
+    color_start = buf.readable();
+    buf.append(to_string_view(lv));
+    color_stop = buf.readable();
+
+    buf.append(R"(","tid":)", 8);
+    detail::append_number(buf, tid);
+    buf.append(R"(,"sid":)", 7);
+    detail::append_number(buf, sid);
+
+    if (const auto pos = file_name.find_last_of("/\\");
+        pos != std::string_view::npos) {
+      file_name = file_name.substr(pos + 1);
+    }
+    buf.append(R"(,"file":")", 9);
+    detail::append_json_escaped(buf, file_name);
+    buf.append(R"(","line":)", 9);
+    detail::append_number(buf, line);
+
+    buf.append(R"(,"msg":")", 8);
+    detail::append_json_escaped(buf, text);
+    buf.append("\"}\n", 3);
+  }
+
+ private:
+  // 每个线程一份，多个线程可以同时格式化
+  struct date_cache {
+    detail::base_memory_buffer<64> text{};
+    std::chrono::sys_seconds last_second{std::chrono::sys_seconds::min()};
+  };
+  static inline thread_local date_cache date_{};
+};
+
+}  // namespace jt::log
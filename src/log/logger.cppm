@@ -9,15 +9,52 @@ import :detail.memory;
 import :detail.buffer;
 import :detail.vector;
 import :log.sink;
+import :log.site;
 import :log.fwd;
 
 export namespace jt::log {
 
 class logger_impl;
 
+// 日志风暴的限制，速率和采样在调用线程格式化之前检查，
+// 每个 logger 的每个调用点单独计数
+struct storm_control {
+  // 每个调用点每秒最多输出的条数，0 不限制
+  std::uint32_t rate{0};
+  // 令牌桶容量，即允许突发的条数
+  std::uint32_t burst{1};
+  // 每个调用点每 sample 条只输出1条，0和1不采样
+  std::uint32_t sample{0};
+  // 合并连续相同的日志，之后输出 "last message repeated N times"
+  bool dedup{false};
+};
+
+struct storm_stats {
+  // 被限速丢弃的日志数
+  std::uint64_t rate_limited{0};
+  // 被采样丢弃的日志数
+  std::uint64_t sampled{0};
+  // 被合并的重复日志数
+  std::uint64_t duplicates{0};
+};
+
+// 回溯缓冲区：比 logger 等级详细、但不超过 lv 的日志只保存在内存中，
+// 参数可以延迟格式化时只保存参数；
+// 同一线程（或同一 sid）输出不低于 trigger 的日志时先把它们写出
+struct backtrace_config {
+  // level::off 关闭
+  level lv{level::off};
+  level trigger{level::error};
+  // 每个线程（或 sid）最多保存的条数，超过后覆盖最旧的
+  std::uint32_t capacity{32};
+  // true 按 sid 分组，false 按线程分组
+  bool by_sid{false};
+};
+
 class logger : public std::enable_shared_from_this<logger> {
  public:
   friend class service_impl;
+  friend class writer_shard;
   using sink_ptr = detail::dynamic_unique_ptr<sink>;
   logger(service& service, const std::string_view& name,
          detail::vector<sink_ptr> sinks, bool async);
@@ -32,16 +69,82 @@ class logger : public std::enable_shared_from_this<logger> {
 
   JT_API void flush();
 
+  // 等待之前提交的日志都已写出并 flush 到 sink，
+  // 按 sink 的 fsync_policy 落盘
+  JT_API auto flush_and_wait() -> std::future<void>;
+
   [[nodiscard]] JT_API auto should_log(level lv) const noexcept -> bool;
 
-  JT_API void log(std::uint32_t sid, level lv, detail::buffer_1k& buf,
-                  const std::source_location& source);
+  // 开启后异步 logger 把可延迟的参数交给写线程格式化
+  JT_API void set_deferred(bool deferred) noexcept;
+
+  [[nodiscard]] JT_API auto is_deferred() const noexcept -> bool;
+
+  JT_API void set_storm_control(const storm_control& control);
+
+  [[nodiscard]] JT_API auto get_storm_control() const noexcept
+      -> storm_control;
+
+  [[nodiscard]] JT_API auto get_storm_stats() const noexcept -> storm_stats;
+
+  // 修改配置会丢弃已经保存的日志
+  JT_API void set_backtrace(const backtrace_config& config);
+
+  [[nodiscard]] JT_API auto get_backtrace() const noexcept -> backtrace_config;
+
+  // 按 storm_control 检查调用点，false 表示丢弃；
+  // suppressed 为这个 logger 的这个调用点上次输出之后丢弃的条数，
+  // 应附在日志后面。之后一直没有日志时由写线程定时单独输出
+  [[nodiscard]] JT_API auto admit(const site& where,
+                                  std::uint64_t& suppressed) noexcept -> bool;
+
+  // 等级为 where.lv，调用者已经检查过等级
+  JT_API void log(std::uint32_t sid, const site& where, detail::buffer_1k& buf);
+
+  // buf 是 encode_deferred 写入的参数
+  JT_API void log_deferred(std::uint32_t sid, const site& where,
+                           detail::buffer_1k& buf);
+
+  // 这个调用点的日志只保存到回溯缓冲区，调用者可以只编码参数
+  [[nodiscard]] JT_API auto backtraces(const site& where) const noexcept
+      -> bool;
 
  protected:
+  void set_shard_key(std::uint32_t key) noexcept;
+
+  [[nodiscard]] auto shard_key() const noexcept -> std::uint32_t;
+
+  void set_handle(std::uint32_t handle) noexcept;
+
+  // service 分配的句柄，消息中只保存句柄
+  [[nodiscard]] auto handle() const noexcept -> std::uint32_t;
+
   void backend_log(const message& msg);
 
+  void backend_log_batch(std::span<const message* const> msgs);
+
   void backend_flush();
 
+  // 返回值同 backend_sync
+  auto backend_end_batch() -> std::chrono::steady_clock::time_point;
+
+  // 写线程定时调用：让 sink 落盘到期的数据，返回最早的下次检查时间
+  auto backend_sync() -> std::chrono::steady_clock::time_point;
+
+  // 写线程定时调用：输出还没有报告的丢弃条数
+  void backend_flush_suppressed();
+
+  // 优先通道：调用线程直接写入 sink 并 flush，不参与合并重复日志
+  void backend_write_through(const message& msg);
+
+  // 崩溃处理：在信号处理函数中调用，写出 sink 的缓存
+  void backend_crash_prepare() noexcept;
+
+  // 崩溃处理：把还在队列中的日志以纯文本直接写入 sink 的文件，
+  // point 由调用方换算，队列中的消息可能只记录了计数器
+  void backend_crash_write(const message& msg,
+                           sink::time_point point) noexcept;
+
  private:
   detail::unique_ptr<logger_impl> impl_;
 };
@@ -2,12 +2,15 @@ export module jt:log.message;
 
 import std;
 import :detail.buffer;
+import :detail.memory;
 import :log.level;
+import :log.site;
 import :log.fwd;
 
 export namespace jt::log {
 
-enum message_type : std::uint8_t { log, flush };
+// deferred 表示 buf 中是延迟格式化的参数，见 :log.deferred
+enum message_type : std::uint8_t { log, flush, deferred };
 
 struct message {
   // ReSharper disable once CppRedundantQualifier
@@ -15,10 +18,19 @@ struct message {
   level lv{level::off};
   std::uint32_t sid{0};
   std::uint64_t tid{0};
-  std::weak_ptr<logger> logger{};
+  // logger 的句柄，写线程据此找到 logger；logger 析构后找不到，消息被丢弃
+  std::uint32_t logger{0};
   std::chrono::system_clock::time_point point{};
-  std::source_location source{};
+  // 开启 tsc_clock 时生产者只记录时间戳计数器，写线程换算出 point 后置 0
+  std::uint64_t tick{0};
+  // 调用点，flush 消息为 nullptr
+  const site* where{nullptr};
   detail::buffer_1k buf;
+  // 延迟格式化的参数，只在写线程调用 backend_log 期间有效
+  const detail::buffer_1k* args{nullptr};
+  // flush_and_wait 的 flush 消息，写线程 flush 之后设置；
+  // 消息被丢弃时随之销毁，等待方得到 broken_promise
+  detail::unique_ptr<std::promise<void>> done{};
 
   std::atomic<void*> next{nullptr};
 };
@@ -0,0 +1,462 @@
+export module jt:log.pattern_formatter;
+
+import std;
+import :detail.buffer;
+import :log.formatter;
+import :log.level;
+import :log.message;
+
+export namespace jt::log {
+
+/**
+ * 编译期解析的格式模式
+ *
+ * | 标志 | 内容                       | 标志 | 内容                         |
+ * |------|----------------------------|------|------------------------------|
+ * | %Y   | 年，4位                    | %l   | 日志等级，即颜色范围         |
+ * | %m   | 月，2位                    | %L   | 日志等级缩写，即颜色范围     |
+ * | %d   | 日，2位                    | %t   | 线程id                       |
+ * | %H   | 时，2位                    | %i   | 服务id                       |
+ * | %M   | 分，2位                    | %s   | 代码文件名，不含目录         |
+ * | %S   | 秒，2位                    | %g   | 代码文件完整路径             |
+ * | %e   | 毫秒，3位                  | %#   | 行数                         |
+ * | %f   | 微秒，6位                  | %!   | 函数名                       |
+ * | %F   | 纳秒，9位                  | %v   | 日志内容                     |
+ * | %%   | 字符 %                     |      |                              |
+ *
+ * % 与标志之间可以加宽度，例如 %5t，数字右对齐、文本左对齐，与 "{:5}" 相同。
+ * 宽度前加 - 为左对齐，加 = 为居中，例如 %-8d、%=10l。
+ * 日期和时间字段按数字处理，所有字段都支持宽度和对齐。
+ * 时间为 UTC，与 default_formatter 一致。每行末尾自动加换行符。
+ */
+template <std::size_t N>
+struct pattern_string {
+  char data[N]{};
+
+  // NOLINTNEXTLINE(*-explicit-constructor)
+  consteval pattern_string(const char (&str)[N]) {
+    std::copy_n(str, N, data);
+  }
+
+  [[nodiscard]] constexpr auto view() const -> std::string_view {
+    return {data, N - 1};
+  }
+};
+
+enum class pattern_field : std::uint8_t {
+  literal,
+  // 同一秒内不变的连续字段和文本，每秒格式化一次后缓存
+  date_group,
+  year,
+  month,
+  day,
+  hour,
+  minute,
+  second,
+  millisecond,
+  microsecond,
+  nanosecond,
+  level_name,
+  level_short,
+  thread_id,
+  service_id,
+  file_name,
+  file_path,
+  line,
+  function,
+  text
+};
+
+enum class pattern_align : std::uint8_t {
+  // 数字右对齐，文本左对齐
+  automatic,
+  left,
+  center
+};
+
+struct pattern_step {
+  pattern_field field{pattern_field::literal};
+  std::uint8_t width{0};
+  pattern_align align{pattern_align::automatic};
+  // date_group 的序号
+  std::uint16_t index{0};
+  // literal 为文本的范围，date_group 为 date_steps 的范围
+  std::uint16_t offset{0};
+  std::uint16_t size{0};
+};
+
+template <std::size_t N>
+struct pattern_program {
+  // 加上换行符后文本最多 N 个字符，步骤数不会更多
+  std::array<pattern_step, N> steps{};
+  std::size_t step_count{0};
+  std::array<pattern_step, N> date_steps{};
+  std::size_t date_step_count{0};
+  std::size_t group_count{0};
+  std::array<char, N> literals{};
+  std::size_t literal_size{0};
+};
+
+consteval auto to_pattern_field(const char flag) -> pattern_field {
+  switch (flag) {
+    case 'Y':
+      return pattern_field::year;
+    case 'm':
+      return pattern_field::month;
+    case 'd':
+      return pattern_field::day;
+    case 'H':
+      return pattern_field::hour;
+    case 'M':
+      return pattern_field::minute;
+    case 'S':
+      return pattern_field::second;
+    case 'e':
+      return pattern_field::millisecond;
+    case 'f':
+      return pattern_field::microsecond;
+    case 'F':
+      return pattern_field::nanosecond;
+    case 'l':
+      return pattern_field::level_name;
+    case 'L':
+      return pattern_field::level_short;
+    case 't':
+      return pattern_field::thread_id;
+    case 'i':
+      return pattern_field::service_id;
+    case 's':
+      return pattern_field::file_name;
+    case 'g':
+      return pattern_field::file_path;
+    case '#':
+      return pattern_field::line;
+    case '!':
+      return pattern_field::function;
+    case 'v':
+      return pattern_field::text;
+    default:
+      throw "unknown pattern flag";
+  }
+}
+
+constexpr auto is_date_field(const pattern_field field) -> bool {
+  return field >= pattern_field::year && field <= pattern_field::second;
+}
+
+template <std::size_t N>
+consteval auto parse_pattern(const pattern_string<N>& pattern)
+    -> pattern_program<N> {
+  pattern_program<N> program;
+  std::array<pattern_step, N> raw{};
+  std::size_t raw_count = 0;
+  const auto add_literal = [&](const char ch) {
+    if (raw_count == 0 || raw[raw_count - 1].field != pattern_field::literal) {
+      raw[raw_count++] = {
+          .offset = static_cast<std::uint16_t>(program.literal_size)};
+    }
+    program.literals[program.literal_size++] = ch;
+    ++raw[raw_count - 1].size;
+  };
+
+  const auto text = pattern.view();
+  for (std::size_t i = 0; i < text.size(); ++i) {
+    if (text[i] != '%') {
+      add_literal(text[i]);
+      continue;
+    }
+
+    auto align = pattern_align::automatic;
+    if (++i < text.size() && (text[i] == '-' || text[i] == '=')) {
+      align = text[i++] == '-' ? pattern_align::left : pattern_align::center;
+    }
+    std::uint32_t width = 0;
+    for (; i < text.size() && text[i] >= '0' && text[i] <= '9'; ++i) {
+      width = width * 10 + static_cast<std::uint32_t>(text[i] - '0');
+    }
+    if (i == text.size()) throw "pattern ends with '%'";
+    if (width > 255) throw "pattern width is too large";
+
+    if (text[i] == '%') {
+      add_literal('%');
+    } else {
+      raw[raw_count++] = {to_pattern_field(text[i]),
+                          static_cast<std::uint8_t>(width), align};
+    }
+  }
+  add_literal('\n');
+
+  // 以日期字段开始的连续日期字段和文本合并为一组
+  for (std::size_t i = 0; i < raw_count;) {
+    if (!is_date_field(raw[i].field)) {
+      program.steps[program.step_count++] = raw[i++];
+      continue;
+    }
+
+    pattern_step group{
+        .field = pattern_field::date_group,
+        .index = static_cast<std::uint16_t>(program.group_count++),
+        .offset = static_cast<std::uint16_t>(program.date_step_count)};
+    for (; i < raw_count && (is_date_field(raw[i].field) ||
+                             raw[i].field == pattern_field::literal);
+         ++i) {
+      program.date_steps[program.date_step_count++] = raw[i];
+      ++group.size;
+    }
+    program.steps[program.step_count++] = group;
+  }
+
+  return program;
+}
+
+// 与 default_formatter 的格式相同，只是不输出服务id
+inline constexpr pattern_string default_pattern{
+    "[%Y-%m-%d %H:%M:%S.%e] [%l] [%5t] [%s:%#] %v"};
+
+/**
+ * 编译期模式的 formatter，每个字段展开为一段专门的代码
+ *
+ * 文本一次 memcpy 写入，日期每秒只格式化一次，
+ * 文件名等来自调用点描述 site，不必每行查找目录分隔符。
+ * @code
+ * s->set_formatter(detail::make_dynamic_unique<
+ *     formatter, pattern_formatter<"%H:%M:%S.%f %L %v">>());
+ * @endcode
+ */
+template <pattern_string Pattern>
+class pattern_formatter final : public formatter {
+ public:
+  void format(const message& msg, detail::buffer_1k& buf,  // NOLINT
+              std::size_t& color_start, std::size_t& color_stop) override {
+    color_start = color_stop = buf.readable();
+    auto& date = date_;
+    if constexpr (program_.group_count > 0) {
+      if (const auto current_second =
+              std::chrono::floor<std::chrono::seconds>(msg.point);
+          current_second != date.last_second) {
+        update_date(date, current_second);
+      }
+    }
+
+    [&]<std::size_t... I>(std::index_sequence<I...>) {
+      (emit<program_.steps[I]>(date, msg, buf, color_start, color_stop),
+       ...);
+    }(std::make_index_sequence<program_.step_count>{});
+  }
+
+  [[nodiscard]] auto is_concurrent() const noexcept -> bool override {
+    return true;
+  }
+
+  [[nodiscard]] auto share_key() const noexcept -> const void* override {
+    return &typeid(pattern_formatter);
+  }
+
+ private:
+  static constexpr auto program_ = parse_pattern(Pattern);
+
+  // 每个线程一份，多个线程可以同时格式化
+  struct date_cache {
+    std::chrono::sys_seconds last_second{std::chrono::sys_seconds::min()};
+    detail::base_memory_buffer<128> text{};
+    std::array<std::size_t, program_.group_count + 1> offsets{};
+  };
+
+  template <pattern_step Step>
+  static void emit(const date_cache& date, const message& msg,
+                   detail::buffer_1k& buf, std::size_t& color_start,
+                   std::size_t& color_stop) {
+    if constexpr (Step.field == pattern_field::literal) {
+      buf.append(program_.literals.data() + Step.offset, Step.size);
+    } else if constexpr (Step.field == pattern_field::date_group) {
+      const auto first = date.offsets[Step.index];
+      buf.append(date.text.begin_read() + first,
+                 date.offsets[Step.index + 1] - first);
+    } else if constexpr (Step.field == pattern_field::millisecond) {
+      emit_field<Step>(buf, digits<3>(fraction<std::milli>(msg.point)));
+    } else if constexpr (Step.field == pattern_field::microsecond) {
+      emit_field<Step>(buf, digits<6>(fraction<std::micro>(msg.point)));
+    } else if constexpr (Step.field == pattern_field::nanosecond) {
+      emit_field<Step>(buf, digits<9>(fraction<std::nano>(msg.point)));
+    } else if constexpr (Step.field == pattern_field::level_name) {
+      append_level<Step>(buf, to_string_view(msg.lv), color_start,
+                         color_stop);
+    } else if constexpr (Step.field == pattern_field::level_short) {
+      append_level<Step>(buf, to_string_view_short(msg.lv), color_start,
+                         color_stop);
+    } else if constexpr (Step.field == pattern_field::thread_id) {
+      append_number<Step>(buf, msg.tid);
+    } else if constexpr (Step.field == pattern_field::service_id) {
+      append_number<Step>(buf, msg.sid);
+    } else if constexpr (Step.field == pattern_field::file_name) {
+      emit_field<Step>(buf, msg.where->file_name);
+    } else if constexpr (Step.field == pattern_field::file_path) {
+      emit_field<Step>(buf, msg.where->file_path);
+    } else if constexpr (Step.field == pattern_field::line) {
+      append_number<Step>(buf, msg.where->line);
+    } else if constexpr (Step.field == pattern_field::function) {
+      emit_field<Step>(buf, msg.where->function_name);
+    } else if constexpr (Step.field == pattern_field::text) {
+      emit_field<Step>(buf, static_cast<std::string_view>(msg.buf));
+    }
+  }
+
+  static void update_date(date_cache& date,
+                          const std::chrono::sys_seconds current_second) {
+    date.last_second = current_second;
+    const auto days = std::chrono::floor<std::chrono::days>(current_second);
+    const std::chrono::year_month_day ymd{days};
+    const std::chrono::hh_mm_ss hms{current_second - days};
+
+    date.text.clear();
+    for (std::size_t i = 0; i < program_.step_count; ++i) {
+      const auto& group = program_.steps[i];
+      if (group.field != pattern_field::date_group) continue;
+
+      for (std::size_t j = group.offset; j < group.offset + group.size; ++j) {
+        switch (const auto& step = program_.date_steps[j]; step.field) {
+          case pattern_field::year:
+            append_field(date.text, step,
+                         digits<4>(static_cast<int>(ymd.year())));
+            break;
+          case pattern_field::month:
+            append_field(date.text, step,
+                         digits<2>(static_cast<unsigned>(ymd.month())));
+            break;
+          case pattern_field::day:
+            append_field(date.text, step,
+                         digits<2>(static_cast<unsigned>(ymd.day())));
+            break;
+          case pattern_field::hour:
+            append_field(date.text, step, digits<2>(hms.hours().count()));
+            break;
+          case pattern_field::minute:
+            append_field(date.text, step, digits<2>(hms.minutes().count()));
+            break;
+          case pattern_field::second:
+            append_field(date.text, step, digits<2>(hms.seconds().count()));
+            break;
+          default:
+            date.text.append(program_.literals.data() + step.offset,
+                             step.size);
+            break;
+        }
+      }
+      date.offsets[group.index + 1] = date.text.readable();
+    }
+  }
+
+  template <typename Period>
+  static auto fraction(const std::chrono::system_clock::time_point& point)
+      -> std::uint64_t {
+    using duration = std::chrono::duration<std::int64_t, Period>;
+    const auto since_epoch = point.time_since_epoch();
+    const auto secs = std::chrono::floor<std::chrono::seconds>(since_epoch);
+    return static_cast<std::uint64_t>(
+        std::chrono::duration_cast<duration>(since_epoch - secs).count());
+  }
+
+  // 固定位数，左侧补0
+  template <std::size_t Width, std::integral T>
+  static auto digits(T value) -> std::array<char, Width> {
+    std::array<char, Width> result;  // NOLINT(*-member-init)
+    for (std::size_t i = Width; i > 0; --i) {
+      result[i - 1] = static_cast<char>('0' + value % 10);
+      value /= 10;
+    }
+    return result;
+  }
+
+  struct padding {
+    std::size_t left{0};
+    std::size_t right{0};
+  };
+
+  static constexpr auto padding_of(const pattern_step& step,
+                                   const std::size_t size) -> padding {
+    if (size >= step.width) return {};
+
+    const std::size_t fill = step.width - size;
+    switch (step.align) {
+      case pattern_align::left:
+        return {0, fill};
+      case pattern_align::center:
+        return {fill / 2, fill - fill / 2};
+      default:
+        return is_number_field(step.field) ? padding{fill, 0}
+                                           : padding{0, fill};
+    }
+  }
+
+  static constexpr auto is_number_field(const pattern_field field) -> bool {
+    return (field >= pattern_field::year &&
+            field <= pattern_field::nanosecond) ||
+           field == pattern_field::thread_id ||
+           field == pattern_field::service_id || field == pattern_field::line;
+  }
+
+  template <std::size_t Fixed>
+  static void append_spaces(detail::base_memory_buffer<Fixed>& buf,
+                            const std::size_t count) {
+    for (std::size_t i = 0; i < count; ++i) {
+      buf.push_back(' ');
+    }
+  }
+
+  template <std::size_t Fixed>
+  static void append_field(detail::base_memory_buffer<Fixed>& buf,
+                           const pattern_step& step,
+                           const std::string_view text) {
+    const auto [left, right] = padding_of(step, text.size());
+    append_spaces(buf, left);
+    buf.append(text);
+    append_spaces(buf, right);
+  }
+
+  template <std::size_t Fixed, std::size_t N>
+  static void append_field(detail::base_memory_buffer<Fixed>& buf,
+                           const pattern_step& step,
+                           const std::array<char, N>& text) {
+    return append_field(buf, step, std::string_view{text.data(), N});
+  }
+
+  // 没有宽度时直接写入
+  template <pattern_step Step, typename Text>
+  static void emit_field(detail::buffer_1k& buf, const Text& text) {
+    if constexpr (Step.width == 0) {
+      buf.append(std::data(text), std::size(text));
+    } else {
+      append_field(buf, Step, text);
+    }
+  }
+
+  // 颜色范围不含补齐的空格
+  template <pattern_step Step>
+  static void append_level(detail::buffer_1k& buf, const std::string_view text,
+                           std::size_t& color_start, std::size_t& color_stop) {
+    const auto [left, right] = padding_of(Step, text.size());
+    append_spaces(buf, left);
+    color_start = buf.readable();
+    buf.append(text);
+    color_stop = buf.readable();
+    append_spaces(buf, right);
+  }
+
+  template <pattern_step Step, std::integral T>
+  static void append_number(detail::buffer_1k& buf, const T value) {
+    if constexpr (Step.width == 0) {
+      detail::append_number(buf, value);
+    } else {
+      char text[24];
+      const auto result =
+          std::to_chars(std::begin(text), std::end(text), value);
+      append_field(buf, Step,
+                   std::string_view{text, static_cast<std::size_t>(
+                                              result.ptr - text)});
+    }
+  }
+
+  static inline thread_local date_cache date_{};
+};
+
+}  // namespace jt::log
@@ -11,10 +11,65 @@ import :detail.vector;
 import :detail.string;
 import :log.level;
 import :log.sink;
+import :log.site;
 import :log.fwd;
 
 export namespace jt::log {
 
+// 线程环形缓冲区写满时的处理策略
+enum class overflow_policy : std::uint8_t {
+  // 等待写线程腾出空间
+  block,
+  // 丢弃新的日志
+  drop_newest,
+  // 覆盖最旧的日志
+  overwrite_oldest
+};
+
+// 写线程没有日志可写时的等待方式，休眠前都会先自旋一段时间，
+// 写线程还在自旋时生产者不需要系统调用
+enum class wakeup_policy : std::uint8_t {
+  // 自旋很短，空闲时基本不占用 CPU
+  cpu_first,
+  // 自旋更久，日志间隔较短时写线程不休眠，占用一个核心
+  latency_first
+};
+
+struct service_config {
+  // 异步日志是否使用每线程的环形缓冲区，
+  // 开启后只保证同一线程内的日志顺序
+  bool thread_ring{false};
+  // 每个线程环形缓冲区的字节数，会向上取整为2的幂
+  std::size_t ring_capacity{256 * 1024};
+  // 环形缓冲区写满时的处理策略
+  overflow_policy overflow{overflow_policy::block};
+  // 写线程数量，每个 logger 固定由其中一个写线程处理，最多64个
+  std::uint32_t writer_threads{1};
+  // 压缩线程数量，可以同时压缩多个文件，大文件也会分块并行压缩，最多64个
+  std::uint32_t lz4_threads{1};
+  // 不低于此等级的异步日志走优先通道，off 表示不启用。
+  // 写线程每处理一条普通日志前都先检查优先通道，写出优先日志后立即 flush。
+  // 每个通道内保持提交顺序，两个通道之间不保证先后，时间戳始终是调用时的时间
+  level priority_level{level::off};
+  // 优先通道的日志在调用线程直接写入 sink 并 flush，不经过写线程
+  bool priority_write_through{false};
+  // 收到 SIGSEGV、SIGABRT、SIGBUS、SIGFPE、SIGILL 时，把队列中还没写出的
+  // 日志以纯文本直接写入 sink 的文件，之后交给原来的信号处理
+  bool crash_handler{false};
+  wakeup_policy wakeup{wakeup_policy::cpu_first};
+  // 异步日志只读取 CPU 的时间戳计数器，由写线程换算为时间。
+  // start 时校准约 10 毫秒，之后写线程每秒重新校准；
+  // CPU 没有不变的计数器时仍使用 system_clock
+  bool tsc_clock{false};
+};
+
+struct service_stats {
+  // 因环形缓冲区写满而丢弃的日志数
+  std::uint64_t ring_dropped{0};
+  // 因环形缓冲区写满而被覆盖的日志数
+  std::uint64_t ring_overwritten{0};
+};
+
 class service {
  public:
   using logger_sptr = std::shared_ptr<logger>;
@@ -31,18 +86,27 @@ class service {
 
   JT_API void clear();
 
-  JT_API void start();
+  JT_API void start(const service_config& config = {});
 
   JT_API void stop();
 
+  [[nodiscard]] JT_API auto stats() -> service_stats;
+
   JT_API auto get_default() -> logger_sptr;
 
   JT_API void set_default(const logger_sptr& ptr);
 
-  JT_API void flush(const logger_wptr& ptr);
+  JT_API void flush(logger& lg);
 
-  JT_API void log(const logger_wptr& ptr, std::uint32_t sid, level lv,
-                  detail::buffer_1k& buf, const std::source_location& source);
+  // 写线程把同一批中的多个 flush 合并后一起完成
+  JT_API auto flush_and_wait(logger& lg) -> std::future<void>;
+
+  JT_API void log(logger& lg, std::uint32_t sid, const site& where,
+                  detail::buffer_1k& buf, bool deferred = false);
+
+  // 输出回溯缓冲区中保存的日志，保留原来的时间和线程，
+  // 与触发它的日志走同一个通道；msg.buf 被移走
+  JT_API void log_backtrace(logger& lg, message& msg, level trigger);
 
   template <std::ranges::input_range R>
     requires std::same_as<std::ranges::range_value_t<R>, sink_ptr>
@@ -57,6 +121,9 @@ class service {
   JT_API auto create_logger(const std::string_view& name, bool async,
                             detail::vector<sink_ptr>& sinks) -> logger_sptr;
 
+  // logger 析构时调用，返回后写线程不会再使用这个 logger
+  void release_handle(std::uint32_t handle) noexcept;
+
   void post_lz4(const std::filesystem::path& file_name,
                 std::string_view lz4_directory);
 
@@ -19,6 +19,16 @@ class JT_API sink {
   using time_point = std::chrono::system_clock::time_point;
   using formatter_ptr = detail::dynamic_unique_ptr<formatter>;
 
+  // write_batch 中一条日志在缓冲区里的位置，color_start、color_stop 为绝对位置
+  struct batch_line {
+    level lv;
+    time_point point;
+    std::size_t start;
+    std::size_t stop;
+    std::size_t color_start;
+    std::size_t color_stop;
+  };
+
   sink();
 
   virtual ~sink() noexcept;
@@ -27,16 +37,66 @@ class JT_API sink {
 
   void log(const message& msg);
 
+  // 加锁一次，把整批日志格式化到同一个缓冲区后调用 write_batch
+  void log_batch(std::span<const message* const> msgs);
+
   void flush();
 
+  // 写线程处理完一批日志后调用，返回值同 sync
+  auto end_batch() -> std::chrono::steady_clock::time_point;
+
+  // 写线程定时调用，见 sync_unlock
+  auto sync() -> std::chrono::steady_clock::time_point;
+
   void set_formatter(formatter_ptr ptr);
 
+  [[nodiscard]] auto should_log(level lv) const noexcept -> bool;
+
+  // 当前 formatter 的 share_key，不能在锁外格式化时为 nullptr
+  [[nodiscard]] auto share_key() const noexcept -> const void*;
+
+  // 当前 formatter 输出纯文本行，崩溃处理只向这样的 sink 写入；
+  // 不加锁，可以在信号处理函数中调用
+  [[nodiscard]] auto is_plain_text() const noexcept -> bool;
+
+  // 不加锁，只在 share_key 不为 nullptr 时调用
+  void format(const message& msg, detail::buffer_1k& buf,
+              std::size_t& color_start, std::size_t& color_stop);
+
+  // 写入其他 sink 已经格式化好的日志，按等级过滤后加锁写入
+  void log_formatted(level lv, const time_point& point,
+                     const detail::buffer_1k& buf, std::size_t color_start,
+                     std::size_t color_stop);
+
+  // 同上，lines 按顺序连续排列在 buf 中
+  void log_batch_formatted(std::span<const batch_line> lines,
+                           const detail::buffer_1k& buf);
+
   virtual void write(level lv, const time_point& point,
                      const detail::buffer_1k& buf, std::size_t color_start,
                      std::size_t color_stop) = 0;
 
+  // 默认逐条调用 write
+  virtual void write_batch(std::span<const batch_line> lines,
+                           const detail::buffer_1k& buf);
+
   virtual void flush_unlock() = 0;
 
+  // 缓存写入的 sink 在这里把缓存写出，返回值同 sync_unlock
+  virtual auto end_batch_unlock() -> std::chrono::steady_clock::time_point {
+    return std::chrono::steady_clock::time_point::max();
+  }
+
+  // 定时落盘的 sink 在这里检查是否到期，返回下次需要检查的时间，
+  // time_point::max() 表示没有等待落盘的数据
+  virtual auto sync_unlock() -> std::chrono::steady_clock::time_point {
+    return std::chrono::steady_clock::time_point::max();
+  }
+
+  // 进程崩溃时在信号处理函数中调用，不加锁，只能使用异步信号安全的操作。
+  // 先写出自己缓存的数据，返回可以直接写入纯文本的文件描述符，-1 表示不支持
+  virtual auto crash_prepare() noexcept -> int { return -1; }
+
  private:
   detail::unique_ptr<sink_impl> impl_;
 };
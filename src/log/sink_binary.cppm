@@ -0,0 +1,55 @@
+module;
+
+#include "../detail/config.h"
+
+export module jt:log.sink.binary;
+
+import std;
+import :log.sink;
+import :log.sink.file;
+import :log.level;
+import :log.fwd;
+import :detail.buffer;
+import :detail.memory;
+
+export namespace jt::log {
+
+class sink_binary_imp;
+
+/**
+ * 二进制日志文件，轮换、压缩与 sink_file 相同，扩展名为 .jtlog
+ *
+ * 每个文件以文件头开始，随后是日志点字典（格式字符串、文件、行号、等级），
+ * 日志记录只保存时间差、tid、sid、日志点序号以及日志内容或打包的参数。
+ * 使用 jt-logdecode 或 decode_binary_log 还原为 default_formatter 的文本格式。
+ * 内部使用自己的 formatter，不要再调用 set_formatter。
+ */
+class JT_API sink_binary final : public sink_file {
+ public:
+  sink_binary(service& s, const sink_file_config& config);
+
+  ~sink_binary() noexcept override;
+
+  void write(level, const time_point& point, const detail::buffer_1k& buf,
+             std::size_t, std::size_t) override;
+
+  // 每条记录写入时才计算时间差，轮换可能发生在任意一条之前
+  void write_batch(std::span<const batch_line> lines,
+                   const detail::buffer_1k& buf) override;
+
+  // 只写出暂存区，纯文本会破坏二进制格式
+  auto crash_prepare() noexcept -> int override;
+
+ private:
+  // tag 是 data 中记录类型的位置，时间差写在它之后
+  void write_record(const time_point& point, const std::uint8_t* data,
+                    std::size_t size, std::size_t tag);
+
+  detail::unique_ptr<sink_binary_imp> binary_;
+};
+
+// 把 sink_binary 写出的文件还原为文本，成功返回 true
+JT_API auto decode_binary_log(std::istream& input, std::ostream& output)
+    -> bool;
+
+}  // namespace jt::log
@@ -21,8 +21,14 @@ class JT_API sink_stdout final : public sink {
   void write(level lv, const time_point&, const detail::buffer_1k& buf,
              std::size_t color_start, std::size_t color_stop) override;
 
+  void write_batch(std::span<const batch_line> lines,
+                   const detail::buffer_1k& buf) override;
+
   void flush_unlock() override;
 
+  // stdio 的缓冲区在崩溃时无法安全写出，只返回文件描述符
+  auto crash_prepare() noexcept -> int override;
+
  private:
   sink_console_impl& impl_;
 };
@@ -36,8 +42,14 @@ class JT_API sink_stderr final : public sink {
   void write(level lv, const time_point&, const detail::buffer_1k& buf,
              std::size_t color_start, std::size_t color_stop) override;
 
+  void write_batch(std::span<const batch_line> lines,
+                   const detail::buffer_1k& buf) override;
+
   void flush_unlock() override;
 
+  // stdio 的缓冲区在崩溃时无法安全写出，只返回文件描述符
+  auto crash_prepare() noexcept -> int override;
+
  private:
   sink_console_impl& impl_;
 };
@@ -50,7 +62,7 @@ template <typename... Args>
 void print_stderr(std::format_string<Args...> fmt, Args&&... args) {
   try {
     detail::buffer_1k buf;
-    std::format_to(std::back_inserter(buf), fmt, std::forward<Args>(args)...);
+    detail::format_to(buf, fmt, std::forward<Args>(args)...);
     write_stderr(buf);
   } catch (...) {
   }
@@ -60,7 +72,7 @@ template <typename... Args>
 void print_stdout(std::format_string<Args...> fmt, Args&&... args) {
   try {
     detail::buffer_1k buf;
-    std::format_to(std::back_inserter(buf), fmt, std::forward<Args>(args)...);
+    detail::format_to(buf, fmt, std::forward<Args>(args)...);
     write_stdout(buf);
   } catch (...) {
   }
@@ -11,6 +11,17 @@ import :detail.string;
 
 export namespace jt::log {
 
+// 日志文件调用 fdatasync 落盘的时机
+enum class fsync_policy : std::uint8_t {
+  // 不调用，由内核自行回写
+  none,
+  // 距上次落盘超过 fsync_interval 才调用；写线程在每批日志结束时检查，
+  // 没有新日志时也定时检查
+  interval,
+  // 每次 flush 时调用，同一批中的多个 flush 合并为一次
+  flush
+};
+
 struct sink_file_config { // NOLINT(*-pro-type-member-init)
   // 日志文件的基础名字
   std::string_view name;
@@ -18,12 +29,43 @@ struct sink_file_config { // NOLINT(*-pro-type-member-init)
   std::string_view directory;
   // lz4文件的目录
   std::string_view lz4_directory;
-  // 日志文件最大大小
+  // 日志文件最大大小；lz4_inline 时按压缩后写入磁盘的大小计算，
+  // 压缩器缓存的数据还没有计入，最多滞后一个 256 KiB 的块
   std::size_t max_size{200 * 1024 * 1024};
   // 是否每日轮换日志文件
   bool daily_rotation{true};
   // 保留文件的时间 单位天
   std::uint32_t keep_days{30};
+  // 写缓存大小，写线程每批日志结束、缓存写满或 flush 时写入文件
+  std::size_t buffer_size{256 * 1024};
+  // 写入时直接压缩为 .lz4 文件，轮换后移动到 lz4 目录，不再需要压缩线程，
+  // flush 时输出当前的 LZ4 块
+  bool lz4_inline{false};
+  // Linux 上使用 io_uring 异步写入，多个缓冲区同时在途，写线程不等待磁盘；
+  // 不支持时退回同步写入，与 lz4_inline 同时开启时不生效
+  bool async_io{false};
+  // 内存映射的文件使用 sink_file_storage::sync
+  fsync_policy fsync{fsync_policy::none};
+  std::chrono::milliseconds fsync_interval{1000};
+};
+
+// flush 时对映射的文件段调用 msync 的方式
+enum class msync_policy : std::uint8_t {
+  // 不调用，由内核自行回写
+  none,
+  // MS_ASYNC，只发起回写
+  async,
+  // MS_SYNC，等待回写完成
+  sync
+};
+
+// 子类选择的文件存储方式
+struct sink_file_storage {
+  // 日志文件的扩展名
+  std::string_view extension{".log"};
+  // 使用预分配并映射到内存的文件段，见 sink_mmap
+  bool mapped{false};
+  msync_policy sync{msync_policy::none};
 };
 
 class sink_file_imp;
@@ -37,8 +79,31 @@ class JT_API sink_file : public sink {
   void write(level, const time_point& point, const detail::buffer_1k& buf,
              std::size_t, std::size_t) override;
 
+  void write_batch(std::span<const batch_line> lines,
+                   const detail::buffer_1k& buf) override;
+
   void flush_unlock() override;
 
+  auto end_batch_unlock() -> std::chrono::steady_clock::time_point override;
+
+  auto sync_unlock() -> std::chrono::steady_clock::time_point override;
+
+  // 写出暂存区；压缩和内存映射的文件不能追加纯文本，返回 -1
+  auto crash_prepare() noexcept -> int override;
+
+ protected:
+  sink_file(service& s, const sink_file_config& config,
+            const sink_file_storage& storage);
+
+  // 按时间和大小检查是否需要轮换，并确保文件已打开
+  auto prepare(const time_point& point) -> bool;
+
+  // 写入当前文件，调用前需要 prepare 成功
+  void append(const void* data, std::size_t size);
+
+  // 每打开一个文件加1，用来判断是否需要写文件头
+  [[nodiscard]] auto file_sequence() const noexcept -> std::uint64_t;
+
  private:
   detail::unique_ptr<sink_file_imp> impl_;
 };
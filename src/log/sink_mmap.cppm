@@ -0,0 +1,32 @@
+module;
+
+#include "../detail/config.h"
+
+export module jt:log.sink.mmap;
+
+import std;
+import :log.sink;
+import :log.sink.file;
+
+export namespace jt::log {
+
+struct sink_mmap_config : sink_file_config {
+  // flush 时调用 msync 的方式
+  msync_policy sync{msync_policy::async};
+};
+
+/**
+ * 预分配并映射到内存的日志文件，轮换、压缩与 sink_file 相同
+ *
+ * 每个文件段按 max_size 预分配后 mmap，写入只是 memcpy，不需要系统调用；
+ * 段写满时轮换，关闭或轮换时截断为实际长度。
+ * 进程崩溃时已拷贝的日志仍由内核写回文件。不支持映射的平台退回普通写入。
+ */
+class JT_API sink_mmap final : public sink_file {
+ public:
+  sink_mmap(service& s, const sink_mmap_config& config);
+
+  ~sink_mmap() noexcept override;
+};
+
+}  // namespace jt::log
@@ -0,0 +1,61 @@
+module;
+
+#include "../detail/config.h"
+
+export module jt:log.site;
+
+import std;
+import :log.level;
+
+export namespace jt::log {
+
+// 编译期的最低日志等级，更详细的日志调用不生成代码，
+// 由 CMake 的 JT_LOG_ACTIVE_LEVEL 设置（0 off ... 6 trace）
+inline constexpr level active_level = static_cast<level>(JT_LOG_ACTIVE_LEVEL);
+
+constexpr auto is_active(const level lv) noexcept -> bool {
+  return static_cast<std::uint8_t>(lv) <=
+         static_cast<std::uint8_t>(active_level);
+}
+
+/**
+ * 日志调用点的描述
+ *
+ * 每个调用点（源码位置、等级、格式字符串）第一次输出时注册，之后一直有效，
+ * 队列中的日志只保存它的指针，不再复制 source_location。
+ */
+struct site {
+  level lv{level::off};
+  std::uint_least32_t line{0};
+  std::uint_least32_t column{0};
+  // 不含目录的文件名
+  std::string_view file_name;
+  std::string_view file_path;
+  std::string_view function_name;
+  // 格式字符串，vlog 等运行时的格式字符串为空
+  std::string_view fmt;
+  // 开启后即使低于 logger 的等级也会输出，见 set_site_enabled
+  std::atomic<bool> enabled{false};
+  // 同一个哈希桶中的下一个调用点
+  const site* next{nullptr};
+};
+
+// 查找或注册调用点，fmt 必须是静态存储的字符串
+[[nodiscard]] JT_API auto get_site(const std::source_location& source,
+                                   level lv, std::string_view fmt)
+    -> const site&;
+
+// 开启的调用点规则数，由 set_site_enabled 维护，不要直接修改
+JT_API extern std::atomic<std::uint32_t> enabled_site_rules;
+
+// 是否有开启的调用点，没有时低于等级的日志不必查找调用点
+[[nodiscard]] inline auto has_enabled_sites() noexcept -> bool {
+  return enabled_site_rules.load(std::memory_order::relaxed) != 0;
+}
+
+// 单独开启或关闭 file_name:line 的调用点，不影响 logger 的等级，
+// file_name 不含目录，对之后才注册的调用点同样有效
+JT_API void set_site_enabled(std::string_view file_name,
+                             std::uint_least32_t line, bool enabled);
+
+}  // namespace jt::log
@@ -0,0 +1,64 @@
+#include <simdjson.h>
+
+import jt;
+import std;
+
+// 用 json_formatter 生成 JSON Lines，再用 simdjson on-demand 解析，
+// 分别输出两边的吞吐量
+int main(int argc, char** argv) {
+  const std::size_t count =
+      argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1'000'000;
+  constexpr std::string_view texts[] = {
+      "user login succeeded",
+      "request /api/v1/items?id=42 took 12ms",
+      R"(payload {"key":"value","list":[1,2,3]})",
+      "path C:\\logs\\app.log\tline 3\nsecond line",
+  };
+
+  jt::log::json_formatter formatter;
+  jt::detail::buffer_1k buf;
+  const auto point = std::chrono::system_clock::now();
+  std::size_t color_start, color_stop;
+
+  const auto format_start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < count; ++i) {
+    formatter.format(point + std::chrono::microseconds(i), jt::log::level::info,
+                     i % 16, static_cast<std::uint32_t>(i % 4), __FILE__,
+                     __LINE__, texts[i % std::size(texts)], buf, color_start,
+                     color_stop);
+  }
+  const std::chrono::duration<double> format_seconds =
+      std::chrono::steady_clock::now() - format_start;
+
+  const simdjson::padded_string input(
+      reinterpret_cast<const char*>(buf.begin_read()), buf.readable());
+  simdjson::ondemand::parser parser;
+  std::size_t parsed = 0;
+  std::size_t msg_bytes = 0;
+  const auto parse_start = std::chrono::steady_clock::now();
+  simdjson::ondemand::document_stream docs;
+  if (parser.iterate_many(input).get(docs)) {
+    std::println(std::cerr, "iterate_many fail");
+    return 1;
+  }
+  for (auto doc : docs) {
+    std::string_view msg;
+    if (doc["msg"].get_string().get(msg)) {
+      std::println(std::cerr, "parse line {} fail", parsed + 1);
+      return 1;
+    }
+    msg_bytes += msg.size();
+    ++parsed;
+  }
+  const std::chrono::duration<double> parse_seconds =
+      std::chrono::steady_clock::now() - parse_start;
+
+  const auto mb = static_cast<double>(buf.readable()) / (1024.0 * 1024.0);
+  std::println("lines {} bytes {} msg bytes {}", parsed, buf.readable(),
+               msg_bytes);
+  std::println("format {:.1f} MB/s {:.0f} lines/s", mb / format_seconds.count(),
+               static_cast<double>(count) / format_seconds.count());
+  std::println("parse  {:.1f} MB/s {:.0f} lines/s", mb / parse_seconds.count(),
+               static_cast<double>(parsed) / parse_seconds.count());
+  return parsed == count ? 0 : 1;
+}
@@ -0,0 +1,32 @@
+import jt;
+import std;
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    std::println(std::cerr, "usage: jt-logdecode <input.jtlog> [output.log]");
+    return 1;
+  }
+
+  std::ifstream input(argv[1], std::ios_base::binary);
+  if (!input.is_open()) {
+    std::println(std::cerr, "open input {} fail", argv[1]);
+    return 1;
+  }
+
+  std::ofstream file;
+  if (argc > 2) {
+    file.open(argv[2], std::ios_base::binary | std::ios_base::trunc);
+    if (!file.is_open()) {
+      std::println(std::cerr, "open output {} fail", argv[2]);
+      return 1;
+    }
+  }
+
+  std::ostream& output = file.is_open() ? file : std::cout;
+  if (!jt::log::decode_binary_log(input, output)) {
+    std::println(std::cerr, "{}: invalid or truncated binary log", argv[1]);
+    return 1;
+  }
+
+  return 0;
+}
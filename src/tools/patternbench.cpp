@@ -0,0 +1,70 @@
+import jt;
+import std;
+
+namespace {
+
+// 格式化 count 行，每 4096 行清空一次缓冲区，返回秒数和输出字节数
+auto run(jt::log::formatter& formatter, std::span<jt::log::message> messages,
+         const std::size_t count) -> std::pair<double, std::size_t> {
+  jt::detail::buffer_1k buf;
+  std::size_t color_start, color_stop;
+  std::size_t bytes = 0;
+  const auto start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < count; ++i) {
+    auto& msg = messages[i % messages.size()];
+    msg.point += std::chrono::microseconds(1);
+    formatter.format(msg, buf, color_start, color_stop);
+    if ((i & 4095) == 4095) {
+      bytes += buf.readable();
+      buf.clear();
+    }
+  }
+  const std::chrono::duration<double> seconds =
+      std::chrono::steady_clock::now() - start;
+  return {seconds.count(), bytes + buf.readable()};
+}
+
+}  // namespace
+
+// 同一组日志分别用 default_formatter 和等价模式的 pattern_formatter
+// 格式化，输出两边的吞吐量
+int main(int argc, char** argv) {
+  const std::size_t count =
+      argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10'000'000;
+  constexpr std::string_view texts[] = {
+      "user login succeeded",
+      "request /api/v1/items?id=42 took 12ms",
+      "cache miss key=session:8f3a ttl=300",
+      "connection closed by peer",
+  };
+
+  const auto& where = jt::log::get_site(std::source_location::current(),
+                                        jt::log::level::info, "{}");
+  std::array<jt::log::message, std::size(texts)> messages;
+  const auto point = std::chrono::system_clock::now();
+  for (std::size_t i = 0; i < messages.size(); ++i) {
+    auto& msg = messages[i];
+    msg.lv = jt::log::level::info;
+    msg.tid = i + 1;
+    msg.point = point;
+    msg.where = &where;
+    msg.buf.append(texts[i]);
+  }
+
+  jt::log::default_formatter default_fmt;
+  jt::log::pattern_formatter<jt::log::default_pattern> pattern_fmt;
+  const auto print = [count](std::string_view name,
+                             const std::pair<double, std::size_t>& result) {
+    const auto [seconds, bytes] = result;
+    const auto mb = static_cast<double>(bytes) / (1024.0 * 1024.0);
+    std::println("{:8} {:.1f} MB/s {:.0f} lines/s {:.1f} ns/line", name,
+                 mb / seconds, static_cast<double>(count) / seconds,
+                 seconds * 1e9 / static_cast<double>(count));
+  };
+  // 先各跑一轮预热
+  run(default_fmt, messages, count / 10 + 1);
+  run(pattern_fmt, messages, count / 10 + 1);
+  print("default", run(default_fmt, messages, count));
+  print("pattern", run(pattern_fmt, messages, count));
+  return 0;
+}